@@ -217,6 +217,19 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write n buffers in one batch: bs[i]'s contents go to disk
+// block blocknos[i], which need not be bs[i]->blockno.
+// All buffers must be locked. Returns once all are on disk,
+// but the writes may reach the disk in any order.
+void
+bwritev(struct buf **bs, uint *blocknos, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_write_batch(bs, blocknos, n);
+}
+
 // Release a locked buffer.
 void
 brelse(struct buf *b)
@@ -1,13 +1,17 @@
 struct buf;
 struct context;
+struct cpage;
+struct dirent;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vdso;
 #ifdef LAB_NET
 struct mbuf;
 struct sock;
@@ -18,10 +22,20 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 void            print_htable();
 
+// pcache.c
+void            pcacheinit(void);
+struct cpage*   pcache_get(uint, uint, uint);
+struct cpage*   pcache_lookup(uint, uint, uint);
+void            pcache_put(struct cpage*);
+void            pcache_inval(uint, uint);
+int             pcache_shrink(void);
+int             pcache_nfree(void);
+
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
@@ -29,6 +43,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -37,14 +52,25 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filegetdents(struct file*, uint64 addr, int n);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int n, uint);
+int             filepwrite(struct file*, uint64, int n, uint);
+int             filesend(struct file*, struct file*, uint*, int);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirread(struct inode*, uint*, struct dirent*, struct inode**, int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*, int);
+int             iexecuting(struct inode*);
+int             isdirempty(struct inode*);
+struct cpage*   igetpage(struct inode*, uint);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -69,11 +95,12 @@ void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
 uint64          kgetfree(void);
+uint64          kgetfreefast(void);
+int             kcommit(int);
+void            kuncommit(int);
 uint32          kref(uint64);
 uint32          krefinc(uint64);
-uint32          krefdec(uint64);
-void            krefacquire(void);
-void            krefrelease(void);
+void            krefput(uint64);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -84,8 +111,9 @@ void            end_op(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipegift(struct pipe*, uint64, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -97,6 +125,7 @@ void            backtrace(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -119,10 +148,14 @@ void            procdump(void);
 uint64          mmap(struct proc *, uint64, int, int, int, struct file*, int);
 int             munmap(struct proc *, uint64, int);
 int             handle_mmap(struct proc *, uint64, uint64);
+int             madvise(struct proc *, uint64, int, int);
+int             msync(struct proc *, uint64, int, int);
+void            vma_wbtick(struct proc *);
+int             vma_search(struct proc *, uint64);
 struct vma_region *
-                vma_alloc();
-void            vma_add(struct proc *, struct vma_region *);
+                vma_insert(struct proc *, uint64);
 void            vma_remove(struct proc *, struct vma_region *);
+int             vma_copy(struct proc *, struct proc *, struct vma_region *);
 int             procnum(void);
 
 // swtch.S
@@ -154,8 +187,14 @@ void*           memset(void*, int, uint);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
+uint            strnlen(const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// trace.c
+struct tracerec;
+void            traceinit(void);
+int             traceput(struct tracerec*);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -167,6 +206,7 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+extern struct vdso *vdso;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -193,11 +233,25 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+void            utlbflush(pagetable_t);
+void            uvmflush(pagetable_t, uint64, uint64);
+uint64          uvmsatp(struct proc *);
+#ifdef KVMSHARE
+int             kvmshare(pagetable_t);
+void            kvmunshare(pagetable_t);
+void            uvmswitch(struct proc *);
+void            kvmswitch(void);
+#endif
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 int             cowcopypage(pagetable_t, uint64);
+int             uvmfault(struct proc *, uint64, uint64);
+void            uvmprefault(struct proc *, uint64, uint64, int);
+int             uvmswappage(pagetable_t, uint64, char**);
+char*           uvmtakepage(struct proc *, uint64);
+int             uvmlazy(pagetable_t, uint64, uint64);
 void            vmprint(pagetable_t);
 int             vm_pgaccess(pagetable_t, uint64, int, char *);
 
@@ -210,6 +264,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_write_batch(struct buf **, uint *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -252,6 +307,6 @@ void            sockinit(void);
 int             sockalloc(struct file **, uint32, uint16, uint16);
 void            sockclose(struct sock *);
 int             sockread(struct sock *, uint64, int);
-int             sockwrite(struct sock *, uint64, int);
+int             sockwrite(struct sock *, int, uint64, int);
 void            sockrecvudp(struct mbuf*, uint32, uint16, uint16);
 #endif
@@ -12,4 +12,14 @@
 
 #define MAP_SHARED      0x01
 #define MAP_PRIVATE     0x02
+#define MAP_ANONYMOUS   0x20  // zero-filled memory, no file; fd is ignored
+
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1  // no fault-around or read-ahead
+#define MADV_SEQUENTIAL 2  // always read ahead
+#define MADV_WILLNEED   3  // read the range into the page cache now
+
+#define MS_ASYNC        0x1  // leave it to the background writeback
+#define MS_INVALIDATE   0x2
+#define MS_SYNC         0x4  // write back before returning
 #endif
@@ -12,6 +12,11 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
+#include "pcache.h"
+
+#define NDENTS 8  // entries filegetdents gathers per lock of the directory
+#define SENDDGRAM 1024  // most bytes filesend puts in one datagram
 
 struct devsw devsw[NDEV];
 struct {
@@ -106,27 +111,150 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read up to n entries of directory f, each with the type,
+// link count and size of the inode it names, into the
+// struct direntplus array at user address addr.
+// Returns the number of entries read; 0 at the end.
+int
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct inode *dp = f->ip, *ips[NDENTS];
+  struct dirent de[NDENTS];
+  struct direntplus dx;
+  int i, m, r = 0;
+
+  if(f->type != FD_INODE || !f->readable || n < 0)
+    return -1;
+
+  while(r < n){
+    ilock(dp);
+    if(dp->type != T_DIR){
+      iunlock(dp);
+      return -1;
+    }
+    m = dirread(dp, &f->off, de, ips, n - r < NDENTS ? n - r : NDENTS);
+    iunlock(dp);
+    if(m == 0)
+      break;
+
+    for(i = 0; i < m; i++){
+      memset(&dx, 0, sizeof(dx));
+      memmove(dx.name, de[i].name, DIRSIZ);
+      ilock(ips[i]);
+      dx.inum = ips[i]->inum;
+      dx.type = ips[i]->type;
+      dx.nlink = ips[i]->nlink;
+      dx.size = ips[i]->size;
+      iunlock(ips[i]);
+      begin_op();
+      iput(ips[i]);
+      end_op();
+      if(copyout(p->pagetable, addr + r*sizeof(dx), (char*)&dx, sizeof(dx)) < 0){
+        // drop the rest of the batch
+        while(++i < m){
+          begin_op();
+          iput(ips[i]);
+          end_op();
+        }
+        return r > 0 ? r : -1;
+      }
+      r++;
+    }
+  }
+  return r;
+}
+
+// Read f's inode at *off into the niov user buffers iov, under
+// one ilock, advancing *off. Stops at a short read.
+static int
+inodereadv(struct file *f, struct iovec *iov, int niov, uint *off)
+{
+  int i, r, n = 0;
+
+  ilock(f->ip);
+  if(f->ip->type == T_DIR && ISHASHED(f->ip) && *off < BSIZE)
+    *off = BSIZE;  // skip the index block; only dirents follow
+  for(i = 0; i < niov; i++){
+    if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len)) < 0){
+      if(n == 0)
+        n = -1;
+      break;
+    }
+    *off += r;
+    n += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return n;
+}
+
+// Write the niov buffers iov, in user memory if user_src, to
+// f's inode at *off, advancing *off. Returns the bytes written,
+// or -1 on error.
+static int
+inodewritev(struct file *f, int user_src, struct iovec *iov, int niov, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  // as many buffers as fit go in one transaction.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, r = 0, n1, m, n = 0;
+  uint64 done = 0;  // bytes of iov[i] written
+
+  while(i < niov){
+    begin_op();
+    ilock(f->ip);
+    for(m = 0; i < niov && m < max; ){
+      n1 = iov[i].iov_len - done < max - m ? iov[i].iov_len - done : max - m;
+      if((r = writei(f->ip, user_src, (uint64)iov[i].iov_base + done, *off, n1)) > 0){
+        *off += r;
+        m += r;
+        done += r;
+      }
+      if(r != n1)
+        break;
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+    }
+    iunlock(f->ip);
+    end_op();
+    n += m;
+
+    if(r != n1){
+      // error from writei
+      return -1;
+    }
+  }
+  return n;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
   int r = 0;
+  struct iovec iov = { (void*)addr, n };
 
   if(f->readable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, 1, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = inodereadv(f, &iov, 1, &f->off);
   }
 #ifdef LAB_NET
   else if(f->type == FD_SOCK){
@@ -140,54 +268,29 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
-int
-filewrite(struct file *f, uint64 addr, int n)
+// Write to file f from addr, a user virtual address if
+// user_src, else a kernel one.
+static int
+writefile(struct file *f, int user_src, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
+  struct iovec iov = { (void*)addr, n };
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    ret = n < 0 ? -1 : inodewritev(f, user_src, &iov, 1, &f->off);
   }
 #ifdef LAB_NET
   else if(f->type == FD_SOCK){
-    ret = sockwrite(f->sock, addr, n);
+    ret = sockwrite(f->sock, user_src, addr, n);
   }
 #endif
   else {
@@ -197,3 +300,161 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return writefile(f, 1, addr, n);
+}
+
+
+// Read from file f into the niov user buffers iov, in order.
+// Files are read under one lock; other kinds one buffer at a
+// time, stopping at a short read.
+int
+filereadv(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, n = 0;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inodereadv(f, iov, niov, &f->off);
+  for(i = 0; i < niov; i++){
+    if((r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return n > 0 ? n : -1;
+    n += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return n;
+}
+
+// Write the niov user buffers iov to file f, in order.
+int
+filewritev(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, n = 0;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inodewritev(f, 1, iov, niov, &f->off);
+  for(i = 0; i < niov; i++){
+    if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return n > 0 ? n : -1;
+    n += r;
+  }
+  return n;
+}
+
+// Read n bytes at offset off of file f, leaving f->off alone.
+// Only files have offsets.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodereadv(f, &iov, 1, &off);
+}
+
+// Write n bytes at offset off of file f, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewritev(f, 1, &iov, 1, &off);
+}
+
+// Move n bytes from file in to file out without a trip through
+// user memory. A file is read at *off, which is advanced, and
+// its pages go from the page cache straight into out's pipe,
+// socket or blocks; a pipe is read through one kernel page,
+// and only what it holds is moved. Returns the bytes moved.
+int
+filesend(struct file *out, struct file *in, uint *off, int n)
+{
+  struct cpage *pg;
+  char *src, *buf = 0;
+  uint end = 0;
+  int m, r = 0, tot = 0;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE && in->type != FD_PIPE)
+    return -1;
+
+  while(tot < n){
+    m = n - tot < PGSIZE ? n - tot : PGSIZE;
+#ifdef LAB_NET
+    if(out->type == FD_SOCK && m > SENDDGRAM)
+      m = SENDDGRAM;
+#endif
+    pg = 0;
+    if(in->type == FD_PIPE){
+      if(buf == 0 && (buf = kalloc()) == 0)
+        break;
+      if((r = piperead(in->pipe, 0, (uint64)buf, m)) <= 0)
+        break;
+      src = buf;
+      n = tot + r;  // no waiting for more
+      m = r;
+    } else {
+      ilock(in->ip);
+      if(in->ip->type != T_FILE){
+        iunlock(in->ip);
+        r = -1;
+        break;
+      }
+      if(*off >= in->ip->size){
+        iunlock(in->ip);
+        break;
+      }
+      if(m > PGSIZE - *off % PGSIZE)
+        m = PGSIZE - *off % PGSIZE;
+      if(m > in->ip->size - *off)
+        m = in->ip->size - *off;
+      if((pg = igetpage(in->ip, *off / PGSIZE)) != 0){
+        src = pg->pa + *off % PGSIZE;
+      } else {
+        // the page cache is full: copy through a page of our own.
+        if((buf == 0 && (buf = kalloc()) == 0) ||
+           readi(in->ip, 0, (uint64)buf, *off, m) != m){
+          iunlock(in->ip);
+          r = -1;
+          break;
+        }
+        src = buf;
+      }
+      // *off may be in->off, which fileread moves under the
+      // inode's lock too: claim the bytes now, while it is held.
+      *off += m;
+      end = *off;
+      iunlock(in->ip);
+    }
+
+    r = writefile(out, 0, (uint64)src, m);
+    if(pg)
+      pcache_put(pg);
+    if(r != m && in->type == FD_INODE){
+      // give back what was not sent, unless *off has moved on.
+      ilock(in->ip);
+      if(*off == end)
+        *off -= m - (r > 0 ? r : 0);
+      iunlock(in->ip);
+    }
+    if(r > 0)
+      tot += r;
+    if(r != m)
+      break;
+  }
+  if(buf)
+    kfree(buf);
+  return tot > 0 ? tot : (r < 0 ? -1 : 0);
+}
@@ -25,6 +25,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // Processes running it as their program
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -33,7 +34,10 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  union {
+    uint addrs[NDIRECT+1];
+    uchar data[NINLINE];
+  };
 };
 
 // map major device number to device functions.
@@ -46,3 +50,4 @@ extern struct devsw devsw[];
 
 #define CONSOLE 1
 #define STATS   2
+#define TRACE   3
@@ -19,6 +19,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pcache.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -231,7 +232,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->data, ip->data, sizeof(ip->data));
   log_write(bp);
   brelse(bp);
 }
@@ -283,6 +284,32 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count one more (n = 1) or one fewer (n = -1) process that
+// runs ip as its program. execfault maps ip's page cache pages
+// into such processes, so while there are any, ip must not be
+// written (see writei and openfile).
+void
+iexec(struct inode *ip, int n)
+{
+  acquire(&itable.lock);
+  ip->nexec += n;
+  if(ip->nexec < 0)
+    panic("iexec");
+  release(&itable.lock);
+}
+
+// Is ip the program of some process?
+int
+iexecuting(struct inode *ip)
+{
+  int r;
+
+  acquire(&itable.lock);
+  r = ip->nexec > 0;
+  release(&itable.lock);
+  return r;
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -304,7 +331,7 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->data, dip->data, sizeof(ip->data));
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -371,6 +398,8 @@ iunlockput(struct inode *ip)
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
+// Content of at most NINLINE bytes is instead stored in
+// ip->data[], which overlays ip->addrs[]; see ISINLINE().
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -404,6 +433,39 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Move the content of an inline inode out to a data block,
+// so that it can grow past NINLINE bytes.
+// Caller must hold ip->lock.
+static void
+iunline(struct inode *ip)
+{
+  uchar data[NINLINE];
+  struct buf *bp;
+
+  memmove(data, ip->data, ip->size);
+  memset(ip->data, 0, sizeof(ip->data));
+  bp = bread(ip->dev, bmap(ip, 0));
+  memmove(bp->data, data, ip->size);
+  log_write(bp);
+  brelse(bp);
+}
+
+// Undo iunline() for an inode that ended up no
+// larger than NINLINE bytes after all.
+// Caller must hold ip->lock.
+static void
+iinline(struct inode *ip)
+{
+  uint addr = ip->addrs[0];
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  memset(ip->data, 0, sizeof(ip->data));
+  memmove(ip->data, bp->data, ip->size);
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -413,6 +475,15 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcache_inval(ip->dev, ip->inum);
+
+  if(ISINLINE(ip)){
+    memset(ip->data, 0, sizeof(ip->data));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -448,6 +519,34 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return page pgno of regular file ip from the page cache,
+// held and filled, or 0 if the page cache is full.
+// Caller must hold ip->lock, and pcache_put the page.
+struct cpage*
+igetpage(struct inode *ip, uint pgno)
+{
+  struct cpage *pg;
+  struct buf *bp;
+  uint off;
+
+  if((pg = pcache_get(ip->dev, ip->inum, pgno)) == 0 || pg->valid)
+    return pg;
+
+  memset(pg->pa, 0, PGSIZE);
+  if(ISINLINE(ip)){
+    if(pgno == 0)
+      memmove(pg->pa, ip->data, ip->size);
+  } else {
+    for(off = 0; off < PGSIZE && pgno*PGSIZE + off < ip->size; off += BSIZE){
+      bp = bread(ip->dev, bmap(ip, (pgno*PGSIZE + off) / BSIZE));
+      memmove(pg->pa + off, bp->data, BSIZE);
+      brelse(bp);
+    }
+  }
+  pg->valid = 1;
+  return pg;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -457,13 +556,33 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct cpage *pg;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+  if(ISINLINE(ip))
+    return either_copyout(user_dst, dst, ip->data + off, n) == -1 ? -1 : n;
+
+  tot = 0;
+  if(ip->type == T_FILE){
+    // Regular files are read through the page cache, and
+    // from the buffer cache below only if it is full.
+    for(; tot<n; tot+=m, off+=m, dst+=m){
+      if((pg = igetpage(ip, off/PGSIZE)) == 0)
+        break;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, pg->pa + (off % PGSIZE), m);
+      pcache_put(pg);
+      if(r == -1)
+        return -1;
+    }
+  }
+
+  for(; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -488,11 +607,34 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct cpage *pg;
+  int spilled = 0;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(iexecuting(ip))  // a running program
+    return -1;
+
+  if(ISINLINE(ip)){
+    if(off + n <= NINLINE){
+      if(either_copyin(ip->data + off, user_src, src, n) == -1)
+        return 0;
+      if((pg = pcache_lookup(ip->dev, ip->inum, 0)) != 0){
+        memmove(pg->pa + off, ip->data + off, n);
+        pcache_put(pg);
+      }
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    // growing past NINLINE; the write below covers block 0
+    // since off <= ip->size <= NINLINE < BSIZE.
+    iunline(ip);
+    spilled = 1;
+  }
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -502,11 +644,18 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    // keep a cached copy of the page up to date.
+    if((pg = pcache_lookup(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      memmove(pg->pa + (off % PGSIZE), bp->data + (off % BSIZE), m);
+      pcache_put(pg);
+    }
     brelse(bp);
   }
 
   if(off > ip->size)
     ip->size = off;
+  if(spilled && ISINLINE(ip))
+    iinline(ip);  // the copy failed early
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
@@ -517,6 +666,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 }
 
 // Directories
+//
+// See struct dxroot in fs.h for the layout. Lookups read at most
+// the index block and the one block that can hold the name, and
+// scan the dirents in place in the buffer cache.
 
 int
 namecmp(const char *s, const char *t)
@@ -524,41 +677,254 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hash of a name, which picks its leaf in a hashed directory.
+// mkfs has a copy of this function.
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261U;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
+
+// Return the slot of name among the n dirents at de, or -1.
+static int
+dirscan(struct dirent *de, int n, char *name)
+{
+  for(int i = 0; i < n; i++)
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0)
+      return i;
+  return -1;
+}
+
+// Return the first free slot among the n dirents at de, or -1.
+static int
+dirfree(struct dirent *de, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(de[i].inum == 0)
+      return i;
+  return -1;
+}
+
+// Return the index of the leaf of root that holds hash h.
+static int
+dxleaf(struct dxroot *root, uint h)
+{
+  int lo = 0, hi = root->nleaf - 1;
+
+  // last leaf whose lowest hash is <= h
+  while(lo < hi){
+    int mid = (lo + hi + 1) / 2;
+    if(root->leaf[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Return the block number within directory dp of the only
+// block that can hold name. dp must not be inline.
+static uint
+dirblock(struct inode *dp, char *name)
+{
+  struct buf *bp;
+  struct dxroot *root;
+  uint bn;
+
+  if(!ISHASHED(dp))
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  root = (struct dxroot*)bp->data;
+  bn = root->leaf[dxleaf(root, dirhash(name))].bn;
+  brelse(bp);
+  return bn;
+}
+
+// Number of dirents in block bn of directory dp.
+static int
+dirblockents(struct inode *dp, uint bn)
+{
+  if(ISHASHED(dp))
+    return bn == 0 ? 0 : DPB;
+  return dp->size / sizeof(struct dirent);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint bn, inum;
+  struct buf *bp;
+  struct dirent *de;
+  int i;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(ISINLINE(dp)){
+    de = (struct dirent*)dp->data;
+    if((i = dirscan(de, dp->size / sizeof(*de), name)) < 0)
+      return 0;
+    if(poff)
+      *poff = i * sizeof(*de);
+    return iget(dp->dev, de[i].inum);
+  }
+
+  bn = dirblock(dp, name);
+  bp = bread(dp->dev, bmap(dp, bn));
+  de = (struct dirent*)bp->data;
+  i = dirscan(de, dirblockents(dp, bn), name);
+  inum = i < 0 ? 0 : de[i].inum;
+  brelse(bp);
+  if(i < 0)
+    return 0;
+
+  // entry matches path element
+  if(poff)
+    *poff = bn * BSIZE + i * sizeof(*de);
+  return iget(dp->dev, inum);
+}
+
+// Copy up to n in-use entries of directory dp, starting at byte
+// offset *off, into de, and advance *off past the slots read.
+// Also returns in ips a reference to the inode each names, so
+// that the entries can't be freed once dp is unlocked.
+// Returns the number of entries copied; 0 at the end.
+int
+dirread(struct inode *dp, uint *off, struct dirent *de, struct inode **ips, int n)
+{
+  struct dirent *des;
+  struct buf *bp;
+  uint bn;
+  int i, m = 0;
+
+  if(ISHASHED(dp) && *off < BSIZE)
+    *off = BSIZE;
+  while(m < n && *off < dp->size){
+    bn = *off / BSIZE;
+    if(ISINLINE(dp)){
+      des = (struct dirent*)dp->data;
+      bp = 0;
+    } else {
+      bp = bread(dp->dev, bmap(dp, bn));
+      des = (struct dirent*)bp->data;
+    }
+    for(i = (*off % BSIZE) / sizeof(*de); i < dirblockents(dp, bn) && m < n; i++){
+      *off = bn * BSIZE + (i + 1) * sizeof(*de);
+      if(des[i].inum != 0){
+        ips[m] = iget(dp->dev, des[i].inum);
+        de[m++] = des[i];
+      }
+    }
+    if(i == dirblockents(dp, bn))
+      *off = (bn + 1) * BSIZE;
+    if(bp)
+      brelse(bp);
+  }
+  return m;
+}
+
+// Turn a full one-block directory into a hashed one: its
+// entries move to leaf block 1, and block 0 becomes the index.
+static void
+dxconvert(struct inode *dp)
+{
+  struct buf *bp, *lbp;
+  struct dxroot *root;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  lbp = bread(dp->dev, bmap(dp, 1));
+  memmove(lbp->data, bp->data, BSIZE);
+  log_write(lbp);
+  brelse(lbp);
+
+  memset(bp->data, 0, BSIZE);
+  root = (struct dxroot*)bp->data;
+  root->nleaf = 1;
+  root->leaf[0].hash = 0;
+  root->leaf[0].bn = 1;
+  log_write(bp);
+  brelse(bp);
+
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+}
+
+// Split the full leaf li of hashed directory dp in two, moving
+// the entries hashing at or above a boundary near the median
+// into a new leaf at the end of the directory.
+// rbp is the locked index block, and bp the locked leaf.
+// Returns 0, or -1 if the directory can't grow any more or
+// every entry in the leaf has the same hash.
+static int
+dxsplit(struct inode *dp, struct buf *rbp, int li, struct buf *bp)
+{
+  struct dxroot *root = (struct dxroot*)rbp->data;
+  struct dirent *old = (struct dirent*)bp->data, *new;
+  uint h[DPB], t, split, newbn;
+  struct buf *nbp;
+  int i, j;
+
+  newbn = dp->size / BSIZE;
+  if(root->nleaf >= DXMAXLEAF || newbn >= MAXFILE)
+    return -1;
+
+  // sort the leaf's hashes, then look for two distinct
+  // neighbours, starting from the middle.
+  for(i = 0; i < DPB; i++){
+    t = dirhash(old[i].name);
+    for(j = i; j > 0 && h[j-1] > t; j--)
+      h[j] = h[j-1];
+    h[j] = t;
+  }
+  for(i = DPB/2; i < DPB && h[i] == h[i-1]; i++)
+    ;
+  if(i == DPB)
+    for(i = DPB/2 - 1; i > 0 && h[i] == h[i-1]; i--)
+      ;
+  if(i == 0)
+    return -1;
+  split = h[i];
+
+  nbp = bread(dp->dev, bmap(dp, newbn));
+  new = (struct dirent*)nbp->data;
+  for(i = j = 0; i < DPB; i++){
+    if(dirhash(old[i].name) >= split){
+      new[j++] = old[i];
+      memset(&old[i], 0, sizeof(old[i]));
     }
   }
+  log_write(nbp);
+  brelse(nbp);
+  log_write(bp);
+
+  for(i = root->nleaf; i > li + 1; i--)
+    root->leaf[i] = root->leaf[i-1];
+  root->leaf[li+1].hash = split;
+  root->leaf[li+1].bn = newbn;
+  root->nleaf++;
+  log_write(rbp);
 
+  dp->size += BSIZE;
+  iupdate(dp);
   return 0;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Returns -1 if name is present or the directory is full.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
+  struct dirent de, *des;
   struct inode *ip;
+  struct buf *rbp, *bp;
+  uint off;
+  int i, li;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -566,20 +932,80 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
-
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
 
-  return 0;
+  if(!ISHASHED(dp)){
+    // Look for an empty dirent, else append one.
+    off = dp->size;
+    if(ISINLINE(dp)){
+      if((i = dirfree((struct dirent*)dp->data, dp->size / sizeof(de))) >= 0)
+        off = i * sizeof(de);
+    } else {
+      bp = bread(dp->dev, bmap(dp, 0));
+      if((i = dirfree((struct dirent*)bp->data, dirblockents(dp, 0))) >= 0)
+        off = i * sizeof(de);
+      brelse(bp);
+    }
+    if(off < BSIZE){
+      if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink");
+      return 0;
+    }
+    dxconvert(dp);
+  }
+
+  // At most one split is needed: it leaves room in both halves.
+  for(;;){
+    rbp = bread(dp->dev, bmap(dp, 0));
+    li = dxleaf((struct dxroot*)rbp->data, dirhash(name));
+    bp = bread(dp->dev, bmap(dp, ((struct dxroot*)rbp->data)->leaf[li].bn));
+    des = (struct dirent*)bp->data;
+    if((i = dirfree(des, DPB)) >= 0){
+      des[i] = de;
+      log_write(bp);
+      brelse(bp);
+      brelse(rbp);
+      return 0;
+    }
+    i = dxsplit(dp, rbp, li, bp);
+    brelse(bp);
+    brelse(rbp);
+    if(i < 0)
+      return -1;
+  }
+}
+
+// Is the directory dp empty except for "." and ".." ?
+int
+isdirempty(struct inode *dp)
+{
+  struct dirent *de;
+  struct buf *bp;
+  uint bn;
+  int i, n, empty = 1;
+
+  for(bn = 0; empty && bn * BSIZE < dp->size; bn++){
+    if(ISINLINE(dp)){
+      de = (struct dirent*)dp->data;
+      n = dp->size / sizeof(*de);
+      bp = 0;
+    } else {
+      bp = bread(dp->dev, bmap(dp, bn));
+      de = (struct dirent*)bp->data;
+      n = dirblockents(dp, bn);
+    }
+    for(i = 0; i < n; i++){
+      if(de[i].inum != 0 && namecmp(de[i].name, ".") != 0 &&
+         namecmp(de[i].name, "..") != 0){
+        empty = 0;
+        break;
+      }
+    }
+    if(bp)
+      brelse(bp);
+  }
+  return empty;
 }
 
 // Paths
@@ -28,6 +28,12 @@ struct superblock {
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
 
+// Files and directories of at most NINLINE bytes keep their
+// content in the inode itself, in place of the block addresses,
+// and have no data blocks at all.
+#define NINLINE 116
+#define ISINLINE(ip) ((ip)->size <= NINLINE)
+
 // On-disk inode structure
 struct dinode {
   short type;           // File type
@@ -35,7 +41,10 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  union {
+    uint addrs[NDIRECT+1];   // Data block addresses
+    uchar data[NINLINE];     // Content, if ISINLINE()
+  };
 };
 
 // Inodes per block.
@@ -51,10 +60,40 @@ struct dinode {
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+#define DIRSIZ 30
 
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
 };
 
+// What getdents returns for each entry of a directory: the
+// name, plus the fields of the inode it names that ls and
+// find would otherwise need a stat for.
+struct direntplus {
+  uint inum;
+  short type;
+  short nlink;
+  uint64 size;
+  char name[DIRSIZ+1];  // NUL-terminated
+};
+
+// Dirents per block
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory of at most one block is a plain array of dirents.
+// A larger one is hashed: block 0 holds a struct dxroot, which
+// indexes the other (leaf) blocks by the hash of the names in them,
+// and each leaf is a block of dirents. Leaf i holds the names whose
+// hash lies in [leaf[i].hash, leaf[i+1].hash); a full leaf is split.
+#define DXMAXLEAF     ((BSIZE - sizeof(uint)) / (2 * sizeof(uint)))
+#define ISHASHED(dp)  ((dp)->size > BSIZE)
+
+struct dxroot {
+  uint nleaf;           // Number of leaves in use
+  struct {
+    uint hash;          // Lowest name hash this leaf holds
+    uint bn;            // Leaf's block number within the directory
+  } leaf[DXMAXLEAF];    // Sorted by hash; leaf[0].hash is 0
+};
+
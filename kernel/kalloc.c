@@ -31,8 +31,11 @@ struct {
   int freecnt[NCPU];
 } kmem;
 
+// pages promised to lazily grown heaps but not yet
+// allocated; see kcommit and growproc.
+static int kcommitted;
+
 static char lock_names[NCPU][7];
-static struct spinlock reflock;
 // page refcnts
 // 32-bit integer is used here to support atomic operations
 // this is a matter of space-time tradeoff
@@ -156,6 +159,9 @@ end:
   if(r) {
     memset((char*)r, 5, PGSIZE); // fill with junk
     REFCNT(r) = 1;
+  } else if(pcache_shrink() > 0) {
+    // the page cache gave some back
+    return kalloc();
   }
   return (void*)r;
 }
@@ -201,30 +207,75 @@ stealmem(int me)
   release(&kmem.locks[me]);
 }
 
-// Collect the amount of free memory
-uint64
-kgetfree()
+// pages on the free lists, less those already promised by
+// kcommit. the counts are read without their locks, so the
+// sum may be a moment stale.
+static int
+knfree()
 {
   int page_cnt = 0;
 
-  // TODO maybe locking is required here?
   for(int i = 0; i < NCPU; i++) {
     page_cnt += kmem.freecnt[i];
   }
 
-  return page_cnt * PGSIZE;
+  return page_cnt - kcommitted;
 }
 
-void
-krefacquire()
+// pages free or reclaimable from the page cache,
+// less those already promised by kcommit.
+static int
+kavail()
+{
+  return knfree() + pcache_nfree();
+}
+
+// Collect the amount of free memory
+uint64
+kgetfree()
+{
+  int page_cnt = kavail();
+
+  return page_cnt > 0 ? (uint64)page_cnt * PGSIZE : 0;
+}
+
+// Free memory, leaving out the page cache pages kgetfree
+// counts: for the clock tick, which must not scan the page
+// cache each time.
+uint64
+kgetfreefast()
+{
+  int page_cnt = knfree();
+
+  return page_cnt > 0 ? (uint64)page_cnt * PGSIZE : 0;
+}
+
+// Promise n pages that will be allocated later, when a
+// lazily grown heap is touched. Fails if fewer are
+// available, so that sbrk still runs out where it would
+// have if it allocated eagerly.
+int
+kcommit(int n)
 {
-  acquire(&reflock);
+  int ok;
+
+  acquire(&kmem.mainlock);
+  if((ok = kavail() >= n))
+    kcommitted += n;
+  release(&kmem.mainlock);
+  return ok ? 0 : -1;
 }
 
+// Return n pages promised by kcommit: they have been
+// allocated, or will not be.
 void
-krefrelease()
+kuncommit(int n)
 {
-  release(&reflock);
+  acquire(&kmem.mainlock);
+  if(n > kcommitted)
+    panic("kuncommit");
+  kcommitted -= n;
+  release(&kmem.mainlock);
 }
 
 uint32
@@ -233,10 +284,17 @@ krefinc(uint64 pa)
   return __sync_fetch_and_add(&REFCNT(pa), 1);
 }
 
-uint32
-krefdec(uint64 pa)
+// Drop a reference to page pa, freeing it if that was the
+// last. The decrement and the test are one atomic operation,
+// so of several CPUs dropping references at once exactly one
+// frees the page, without a lock.
+void
+krefput(uint64 pa)
 {
-  return __sync_fetch_and_sub(&REFCNT(pa), 1);
+  if(__sync_sub_and_fetch(&REFCNT(pa), 1) == 0) {
+    REFCNT(pa) = 1;  // as kfree expects
+    kfree((void*)pa);
+  }
 }
 
 uint32
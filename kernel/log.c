@@ -24,16 +24,21 @@
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     and a checksum over those block #s and the contents of A, B, C
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The header and the logged blocks are written to disk together in
+// one batch, in no particular order. Recovery recomputes the checksum
+// to tell a committed transaction from one torn by a crash while the
+// batch was in flight, and discards the latter.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint checksum;  // see logsum(); only meaningful if n > 0
   int block[LOGSIZE];
 };
 
@@ -51,6 +56,20 @@ struct log log;
 static void recover_from_log(void);
 static void commit();
 
+#define LOGSUM_INIT 2166136261U
+
+// Fold nw words into running checksum h (32-bit FNV-1a,
+// a word at a time). A transaction's checksum is folded from
+// LOGSUM_INIT over lh.n, lh.block[0..n-1], then the logged
+// blocks' contents in log order.
+static uint
+logsum(uint h, uint *w, int nw)
+{
+  for(int i = 0; i < nw; i++)
+    h = (h ^ w[i]) * 16777619U;
+  return h;
+}
+
 void
 initlog(int dev, struct superblock *sb)
 {
@@ -64,21 +83,32 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// writing all of the home locations in one batch.
+// Outside of recovery, the pinned cache blocks still hold
+// exactly what was logged, so the log isn't read back.
 static void
 install_trans(int recovering)
 {
+  struct buf *dbufs[LOGSIZE];
+  uint blocknos[LOGSIZE];
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    if(recovering){
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    dbufs[tail] = dbuf;
+    blocknos[tail] = dbuf->blockno;
+  }
+  bwritev(dbufs, blocknos, log.lh.n);  // write dsts to disk
+  for (tail = 0; tail < log.lh.n; tail++) {
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(dbufs[tail]);
+    brelse(dbufs[tail]);
   }
 }
 
@@ -90,25 +120,54 @@ read_head(void)
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
+  log.lh.checksum = lh->checksum;
+  for (i = 0; i < log.lh.n && i < LOGSIZE; i++) {
     log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Is the transaction in the in-memory log header complete on disk?
+// Recomputes its checksum from the log blocks.
+static int
+log_valid(void)
+{
+  uint sum;
+  int tail;
+
+  if (log.lh.n < 0 || log.lh.n > LOGSIZE || log.lh.n >= log.size)
+    return 0;
+  sum = logsum(LOGSUM_INIT, (uint*)&log.lh.n, 1);
+  sum = logsum(sum, (uint*)log.lh.block, log.lh.n);
+  for (tail = 0; tail < log.lh.n; tail++) {
+    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+    sum = logsum(sum, (uint*)lbuf->data, BSIZE/sizeof(uint));
+    brelse(lbuf);
+  }
+  return sum == log.lh.checksum;
+}
+
+// Copy the in-memory log header into the header block's buffer.
 static void
-write_head(void)
+fill_head(struct buf *buf)
 {
-  struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
   hb->n = log.lh.n;
+  hb->checksum = log.lh.checksum;
   for (i = 0; i < log.lh.n; i++) {
     hb->block[i] = log.lh.block[i];
   }
+}
+
+// Write in-memory log header to disk on its own.
+// Only used to erase a transaction from the log;
+// commits go through write_log().
+static void
+write_head(void)
+{
+  struct buf *buf = bread(log.dev, log.start);
+  fill_head(buf);
   bwrite(buf);
   brelse(buf);
 }
@@ -117,6 +176,12 @@ static void
 recover_from_log(void)
 {
   read_head();
+  if (log.lh.n != 0 && !log_valid()) {
+    // crashed with the commit batch only partly on disk:
+    // the transaction never committed, so drop it.
+    printf("log: discarding torn transaction\n");
+    log.lh.n = 0;
+  }
   install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
@@ -174,28 +239,42 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write modified blocks from cache to log, together with the
+// header. The blocks go straight from their (pinned) cache
+// buffers to the log blocks, without a copy.
+// This is the true point at which the current transaction
+// commits: once all of the batch is on disk.
 static void
 write_log(void)
 {
+  struct buf *bufs[LOGSIZE+1];
+  uint blocknos[LOGSIZE+1];
+  uint sum;
   int tail;
 
+  sum = logsum(LOGSUM_INIT, (uint*)&log.lh.n, 1);
+  sum = logsum(sum, (uint*)log.lh.block, log.lh.n);
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    bufs[tail] = bread(log.dev, log.lh.block[tail]); // cache block
+    blocknos[tail] = log.start+tail+1; // log block
+    sum = logsum(sum, (uint*)bufs[tail]->data, BSIZE/sizeof(uint));
   }
+  log.lh.checksum = sum;
+
+  bufs[tail] = bread(log.dev, log.start); // header block
+  blocknos[tail] = log.start;
+  fill_head(bufs[tail]);
+
+  bwritev(bufs, blocknos, log.lh.n+1);  // write the log
+  for (tail = 0; tail <= log.lh.n; tail++)
+    brelse(bufs[tail]);
 }
 
 static void
 commit()
 {
   if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
+    write_log();     // Write header and modified blocks to log -- the real commit
     install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
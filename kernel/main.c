@@ -28,8 +28,10 @@ main()
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pcacheinit();    // file page cache
     iinit();         // inode table
     fileinit();      // file table
+    traceinit();     // system call trace device
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
     pci_init();
@@ -33,6 +33,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define NSPERTIME 100  // qemu's mtime, and time CSR, count at 10 MHz
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -55,9 +56,16 @@
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
+#ifdef KVMSHARE
+// map kernel stacks just above PHYSTOP, in the part of the
+// kernel that every process's page table shares (see kvmshare),
+// each surrounded by invalid guard pages.
+#define KSTACK(p) (PHYSTOP + (p)*2*PGSIZE + PGSIZE)
+#else
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - (p)*2*PGSIZE - 3*PGSIZE)
+#endif
 
 // User memory layout.
 // Address zero first:
@@ -66,14 +74,24 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   VDSO (read-only, the same page in every process)
 //   USYSCALL (shared with kernel)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
-#ifdef LAB_PGTBL
 #define USYSCALL (TRAPFRAME - PGSIZE)
+#define VDSO (USYSCALL - PGSIZE)
 
 struct usyscall {
   int pid;  // Process ID
 };
-#endif
+
+// kernel data that user code reads without a system call.
+// each field is one aligned word, updated in one store.
+struct vdso {
+  uint64 ticks;      // clock ticks since boot, as uptime()
+  uint64 freemem;    // bytes free as of the last tick, less than
+                     // sysinfo()'s by the reclaimable page cache
+  uint64 nspertime;  // nanoseconds per count of the time CSR
+  int ncpu;          // CPUs running
+};
@@ -9,5 +9,8 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NPCACHE     256  // size of file page cache, in pages
+#define WBINTERVAL   30  // ticks between MAP_SHARED writeback passes
+#define WBBATCH      64  // dirty pages per region per writeback pass
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
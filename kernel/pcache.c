@@ -0,0 +1,208 @@
+// Page cache.
+//
+// The page cache holds whole 4096-byte pages of regular file data,
+// so that read() and mmap see the same physical page: readi copies
+// out of it, and a MAP_SHARED fault maps the page itself into the
+// process.
+//
+// The cache owns one reference (in kalloc's refarray) to each of
+// its pages, and every page table that maps a page holds another.
+// A page can only be recycled for other data when no caller holds
+// it (refcnt == 0) and no page table maps it (kref(pa) == 1).
+//
+// Interface:
+// * To get a page of an inode, call pcache_get, with the
+//     inode locked; fill it if it isn't valid yet.
+// * pcache_lookup returns a page only if it is already cached.
+// * When done with the page, call pcache_put.
+// * pcache_inval drops all pages of an inode.
+//
+// Every caller holds the inode's sleep-lock, which serializes the
+// filling of a page and keeps the contents in step with writei.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "pcache.h"
+
+#define NPBUCKET 61
+#define PHASH(dev, inum, pgno) (((dev) * 31 + (inum) * 17 + (pgno)) % NPBUCKET)
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *htable[NPBUCKET];  // cached pages, by key
+  uint clock;  // for lastuse
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct cpage*
+pcache_find(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg;
+
+  for(pg = pcache.htable[PHASH(dev, inum, pgno)]; pg; pg = pg->next)
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+// Take pg out of the hash table, and forget its key.
+static void
+pcache_unhash(struct cpage *pg)
+{
+  struct cpage **pp;
+
+  if(pg->inum == 0)
+    return;
+  for(pp = &pcache.htable[PHASH(pg->dev, pg->inum, pg->pgno)]; *pp != pg; pp = &(*pp)->next)
+    ;
+  *pp = pg->next;
+  pg->next = 0;
+  pg->valid = 0;
+  pg->dev = pg->inum = 0;
+}
+
+// Return page pgno of inode (dev, inum), held.
+// The page may not be valid yet; the caller then fills it
+// and sets valid. Returns 0 if every page is in use.
+struct cpage*
+pcache_get(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg, *victim = 0;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find(dev, inum, pgno)) != 0){
+    pg->refcnt++;
+    release(&pcache.lock);
+    return pg;
+  }
+
+  // Not cached; recycle the least recently used free page,
+  // preferring one that was never allocated.
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->pa == 0){
+      victim = pg;
+      break;
+    }
+    if(pg->refcnt == 0 && kref((uint64)pg->pa) == 1 &&
+       (victim == 0 || pg->lastuse < victim->lastuse))
+      victim = pg;
+  }
+  if(victim && victim->pa == 0 && (victim->pa = kalloc()) == 0)
+    victim = 0;
+  if(victim){
+    pcache_unhash(victim);
+    victim->dev = dev;
+    victim->inum = inum;
+    victim->pgno = pgno;
+    victim->refcnt = 1;
+    victim->next = pcache.htable[PHASH(dev, inum, pgno)];
+    pcache.htable[PHASH(dev, inum, pgno)] = victim;
+  }
+  release(&pcache.lock);
+  return victim;
+}
+
+// Return page pgno of inode (dev, inum), held, if it is
+// cached and valid. Otherwise return 0.
+struct cpage*
+pcache_lookup(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcache_find(dev, inum, pgno)) != 0 && pg->valid)
+    pg->refcnt++;
+  else
+    pg = 0;
+  release(&pcache.lock);
+  return pg;
+}
+
+// Release a page returned by pcache_get or pcache_lookup.
+void
+pcache_put(struct cpage *pg)
+{
+  acquire(&pcache.lock);
+  if(pg->refcnt < 1)
+    panic("pcache_put");
+  if(--pg->refcnt == 0)
+    pg->lastuse = pcache.clock++;
+  if(!pg->valid){
+    // the caller failed to fill it.
+    pcache_unhash(pg);
+  }
+  release(&pcache.lock);
+}
+
+// Give the pages nobody is using back to kalloc, which calls
+// this when it runs out of memory. Returns the number freed.
+int
+pcache_shrink(void)
+{
+  struct cpage *pg;
+  int n = 0;
+
+  // kalloc called from pcache_get.
+  if(holding(&pcache.lock))
+    return 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->pa && pg->refcnt == 0 && kref((uint64)pg->pa) == 1){
+      kfree(pg->pa);
+      pg->pa = 0;
+      pcache_unhash(pg);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Count the pages pcache_shrink could give back.
+int
+pcache_nfree(void)
+{
+  struct cpage *pg;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++)
+    if(pg->pa && pg->refcnt == 0 && kref((uint64)pg->pa) == 1)
+      n++;
+  release(&pcache.lock);
+  return n;
+}
+
+// Drop all pages of inode (dev, inum), whose contents are
+// going away. Pages still mapped by some process are left
+// to that mapping, which frees them when it is removed.
+void
+pcache_inval(uint dev, uint inum)
+{
+  struct cpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->inum != inum || pg->dev != dev)
+      continue;
+    if(pg->refcnt != 0)
+      panic("pcache_inval: busy");
+    if(kref((uint64)pg->pa) > 1){
+      // still mapped: leave it to the last mapping to free.
+      krefput((uint64)pg->pa);
+      pg->pa = 0;
+    }
+    pcache_unhash(pg);
+  }
+  release(&pcache.lock);
+}
@@ -0,0 +1,11 @@
+struct cpage {
+  int valid;   // has data been read from disk?
+  uint dev;
+  uint inum;
+  uint pgno;   // page number within the file
+  int refcnt;  // callers holding the page
+  uint lastuse;
+  char *pa;    // the physical page, or 0
+  struct cpage *next;  // hash chain
+};
+
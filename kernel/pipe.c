@@ -8,21 +8,26 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define PIPEPAGES 4  // pages of buffer
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];  // the buffer, a ring of pages
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// the page of pi's buffer that holds byte i.
+#define PIPEPAGE(pi, i) (&(pi)->page[((i) / PGSIZE) % PIPEPAGES])
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
@@ -30,6 +35,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -46,8 +55,12 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    for(i = 0; i < PIPEPAGES; i++)
+      if(pi->page[i])
+        kfree(pi->page[i]);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -71,15 +84,23 @@ pipeclose(struct pipe *pi, int writable)
 #ifdef LAB_LOCK
     freelock(&pi->lock);
 #endif    
+    for(int i = 0; i < PIPEPAGES; i++)
+      kfree(pi->page[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
-int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+// Write n bytes at addr, a user address if user_src, else a
+// kernel one, to pi, copying as much as fits at a time. If gift
+// is set, whole pages of an anonymous region that addr covers
+// are taken instead of copied, leaving them to fault in as zeros.
+static int
+pipeput(struct pipe *pi, int user_src, uint64 addr, int n, int gift)
 {
-  int i = 0;
+  int i = 0, m;
+  uint off;
+  char **pg, *mem;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -91,13 +112,24 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      continue;
     }
+    off = pi->nwrite % PGSIZE;
+    pg = PIPEPAGE(pi, pi->nwrite);
+    m = n - i;
+    if(m > PGSIZE - off)
+      m = PGSIZE - off;
+    if(m > pi->nread + PIPESIZE - pi->nwrite)
+      m = pi->nread + PIPESIZE - pi->nwrite;
+    if(gift && off == 0 && m == PGSIZE && (addr + i) % PGSIZE == 0 &&
+       (mem = uvmtakepage(pr, addr + i)) != 0){
+      kfree(*pg);
+      *pg = mem;
+    } else if(either_copyin(*pg + off, user_src, addr + i, m) == -1){
+      break;
+    }
+    pi->nwrite += m;
+    i += m;
   }
   wakeup(&pi->nread);
   release(&pi->lock);
@@ -106,11 +138,30 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 }
 
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i;
+  return pipeput(pi, user_src, addr, n, 0);
+}
+
+// vmsplice: write n bytes at user address addr to pi, giving
+// it whole pages where it can.
+int
+pipegift(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeput(pi, 1, addr, n, 1);
+}
+
+// Read up to n bytes from pi into addr, a user address if
+// user_dst, else a kernel one. A whole page read into a whole
+// user page is not copied: the reader's page and the pipe's
+// are exchanged.
+int
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
+{
+  int i, m;
+  uint off;
+  char **pg;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -120,12 +171,21 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % PGSIZE;
+    pg = PIPEPAGE(pi, pi->nread);
+    m = n - i;
+    if(m > PGSIZE - off)
+      m = PGSIZE - off;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(user_dst && off == 0 && m == PGSIZE && (addr + i) % PGSIZE == 0 &&
+       uvmswappage(pr->pagetable, addr + i, pg) == 0){
+      // exchanged; nothing to copy.
+    } else if(either_copyout(user_dst, addr + i, *pg + off, m) == -1){
       break;
+    }
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
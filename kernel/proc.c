@@ -30,8 +30,6 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-struct vma_region vma_list[VMA_REGION_COUNT];
-
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -58,73 +56,74 @@ procinit(void)
   initlock(&wait_lock, "wait_lock");
   for(p = proc; p < &proc[NPROC]; p++) {
     initlock(&p->lock, "proc");
+    initlock(&p->vmalock, "vma");
     p->kstack = KSTACK((int) (p - proc));
   }
-  for(int i = 0; i < VMA_REGION_COUNT; i++) {
-    initlock(&vma_list[i].lock, "vma");
-    vma_list[i].next = 0;
-  }
 }
 
-// Allocate a vma region object
-// return with lock held
-struct vma_region*
-vma_alloc()
+// Index of the first region of p that ends after addr,
+// or p->nvma if there is none.
+// Caller must hold p->vmalock.
+int
+vma_search(struct proc *p, uint64 addr)
 {
-  for(int i = 0; i < VMA_REGION_COUNT; i++) {
-    acquire(&vma_list[i].lock);
-    if(vma_list[i].addr == 0) {
-      return &vma_list[i]; 
-    } else {
-      release(&vma_list[i].lock);
-    }
+  int lo = 0, hi = p->nvma;
+
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(VMA_END(&p->vma[mid]) <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
-  // no availble vma region
-  return 0;
+  return lo;
 }
 
-// add vma to proc
-// should be called with vma lock held
-void
-vma_add(struct proc *p, struct vma_region *vma)
+// Add a region at addr to p, keeping p->vma sorted, and
+// return it zeroed but for addr; 0 if p has too many.
+// Pointers to p's other regions are invalid afterwards.
+// Caller must hold p->vmalock.
+struct vma_region*
+vma_insert(struct proc *p, uint64 addr)
 {
-  vma->next = p->vma;
-  p->vma = vma;
+  struct vma_region *vma;
+  int i;
+
+  if(p->nvma == VMA_REGION_COUNT)
+    return 0;
+  i = vma_search(p, addr);
+  memmove(&p->vma[i+1], &p->vma[i], (p->nvma - i) * sizeof(p->vma[0]));
+  p->nvma++;
+  p->vmahint = i;
+  vma = &p->vma[i];
+  memset(vma, 0, sizeof(*vma));
+  vma->addr = addr;
+  return vma;
 }
 
 // remove the vma from proc
-// this function should be called with vma lock held
-// and return lock released
+// this function should be called with p->vmalock held
+// and returns with it released, since closing the
+// file may sleep.
 void
 vma_remove(struct proc *p, struct vma_region *vma)
 {
-  struct vma_region *prev;
   struct file *f;
-  if(!vma) {
-    panic("vma_remove: vma");
-  }
-  if(!holding(&vma->lock)) {
+  int i = vma - p->vma;
+
+  if(!holding(&p->vmalock)) {
     panic("vma_remove: lock");
   }
-  if(!p->vma) {
-    panic("vma_remove: list empty");
-  }
-  if(p->vma == vma) {
-    p->vma = p->vma->next;
-  } else {
-    for(prev = p->vma; prev && prev->next != vma; prev = prev->next) ;
-    if(prev && prev->next == vma) {
-      prev->next = vma->next;
-    } else {
-      panic("vma_remove: not found");
-    }
+  if(i < 0 || i >= p->nvma) {
+    panic("vma_remove: not found");
   }
-  vma->next = 0;
-  vma->addr = 0;
   f = vma->f;
-  vma->f = 0;
-  release(&vma->lock);
-  fileclose(f);
+  memmove(&p->vma[i], &p->vma[i+1], (p->nvma - i - 1) * sizeof(p->vma[0]));
+  p->nvma--;
+  p->vmahint = 0;
+  release(&p->vmalock);
+  if(f)
+    fileclose(f);
 }
 
 // Must be called with interrupts disabled,
@@ -198,7 +197,6 @@ found:
     return 0;
   }
 
-#ifdef LAB_PGTBL
   // Allocate a USYSCALL page
   if((p->usyscall = (struct usyscall *)kalloc()) == 0) {
     freeproc(p);
@@ -206,7 +204,6 @@ found:
     return 0;
   }
   p->usyscall->pid = p->pid;
-#endif
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
@@ -241,6 +238,7 @@ freeproc(struct proc *p)
   p->trapframe = 0;
   if(p->usyscall)
     kfree((void *)p->usyscall);
+  p->usyscall = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -252,7 +250,17 @@ freeproc(struct proc *p)
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
-  p->vma = 0;
+  p->nvma = 0;
+  p->vmahint = 0;
+  p->wbnext = 0;
+  p->nseg = 0;
+  p->execend = 0;
+  memset(p->utlb, 0, sizeof(p->utlb));
+  p->asid = 0;
+  p->tlbharts = 0;
+  p->tlbstale = 0;
+  kuncommit(p->nlazy);
+  p->nlazy = 0;
   if(p->alarm.f) {
     kfree(p->alarm.f);
   }
@@ -288,14 +296,30 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-#ifdef LAB_PGTBL
   // map the USYSCALL page to speed up syscalls
   if(mappages(pagetable, USYSCALL, PGSIZE,
               (uint64)(p->usyscall), PTE_R | PTE_U) < 0) {
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
+  // and the VDSO page, which every process shares.
+  if(mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0) {
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
     uvmunmap(pagetable, USYSCALL, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
+
+#ifdef KVMSHARE
+  // and the kernel, so that traps need not switch page tables.
+  if(kvmshare(pagetable) < 0){
+    proc_freepagetable(pagetable, 0);
+    return 0;
+  }
 #endif
   return pagetable;
 }
@@ -305,11 +329,13 @@ proc_pagetable(struct proc *p)
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
+#ifdef KVMSHARE
+  kvmunshare(pagetable);
+#endif
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
-#ifdef LAB_PGTBL
   uvmunmap(pagetable, USYSCALL, 1, 0);
-#endif
+  uvmunmap(pagetable, VDSO, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -356,16 +382,44 @@ userinit(void)
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz, newsz, lo;
+  int npages, i;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // allocate nothing yet: pages are faulted in as they are
+    // touched (see heapfault). but promise them now, so that
+    // sbrk fails when memory is short, as it always has.
+    newsz = sz + n;
+    if(newsz > HEAPTOP)
+      return -1;
+    acquire(&p->vmalock);
+    i = vma_search(p, sz);
+    if(i < p->nvma && p->vma[i].addr < newsz) {
+      release(&p->vmalock);
       return -1;
     }
+    release(&p->vmalock);
+    npages = (PGROUNDUP(newsz) - PGROUNDUP(sz)) / PGSIZE;
+    if(kcommit(npages) < 0)
+      return -1;
+    p->nlazy += npages;
+    sz = newsz;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(-(uint64)n > sz)
+      return -1;
+    newsz = sz + n;
+    // the program's pages below execend were never promised;
+    // and once freed they are not read in again.
+    lo = PGROUNDUP(newsz) > p->execend ? PGROUNDUP(newsz) : p->execend;
+    npages = lo < PGROUNDUP(sz) ? (PGROUNDUP(sz) - lo) / PGSIZE : 0;
+    npages = uvmlazy(p->pagetable, lo, npages);
+    kuncommit(npages);
+    p->nlazy -= npages;
+    if(p->execend > PGROUNDUP(newsz))
+      p->execend = PGROUNDUP(newsz);
+    sz = uvmdealloc(p->pagetable, sz, newsz);
   }
   p->sz = sz;
   return 0;
@@ -385,7 +439,14 @@ fork(void)
     return -1;
   }
 
-  // Copy user memory from parent to child.
+  // Copy user memory from parent to child. the child's copy
+  // of the untouched part of the heap needs pages promised too.
+  if(kcommit(p->nlazy) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->nlazy = p->nlazy;
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
@@ -393,22 +454,31 @@ fork(void)
   }
   np->sz = p->sz;
 
-  // copy vma regions
-  struct vma_region **vp = &p->vma;
-  struct vma_region **vnp = &np->vma;
-  while(*vp) {
-    struct vma_region *nvma = vma_alloc();
-    nvma->addr = (*vp)->addr;
-    nvma->length = (*vp)->length;
-    nvma->flags = (*vp)->flags;
-    nvma->prot = (*vp)->prot;
-    nvma->offset = (*vp)->offset;
-    nvma->f = filedup((*vp)->f);
-    *vnp = nvma;
-    vnp = &(*vnp)->next;
-    release(&nvma->lock);
-    vp = &(*vp)->next;
+  // copy vma regions. anonymous ones have their pages copied
+  // like the heap's; the child faults the others in again.
+  acquire(&p->vmalock);
+  for(i = 0; i < p->nvma; i++) {
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].f == 0 && vma_copy(p, np, &np->vma[i]) < 0)
+      break;
+  }
+  if(i < p->nvma) {
+    for(; i >= 0; i--) {
+      if(np->vma[i].f == 0)
+        uvmunmap(np->pagetable, np->vma[i].addr,
+                 (VMA_END(&np->vma[i]) - np->vma[i].addr) / PGSIZE, 1);
+    }
+    release(&p->vmalock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  for(i = 0; i < p->nvma; i++) {
+    if(np->vma[i].f)
+      filedup(np->vma[i].f);
   }
+  np->nvma = p->nvma;
+  release(&p->vmalock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -425,6 +495,15 @@ fork(void)
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
 
+  // the child faults in the rest of the program too.
+  if(p->execip){
+    np->execip = idup(p->execip);
+    iexec(np->execip, 1);
+  }
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+  np->execend = p->execend;
+
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -442,6 +521,64 @@ fork(void)
   return pid;
 }
 
+// Create a child running program path with arguments argv:
+// fork and exec in one, without copying the parent's memory
+// only for exec to throw it away. The child's open files are
+// ofile, whose references the caller gives up, even on failure.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  int fd, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0){
+    for(fd = 0; fd < NOFILE; fd++)
+      if(ofile[fd])
+        fileclose(ofile[fd]);
+    return -1;
+  }
+  // np is USED but has no parent yet, so nothing else uses it
+  // while execproc sleeps reading the program in.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  for(fd = 0; fd < NOFILE; fd++)
+    np->ofile[fd] = ofile[fd];
+  np->cwd = idup(p->cwd);
+  np->tracemask = p->tracemask;
+
+  if((argc = execproc(np, path, argv)) < 0){
+    for(fd = 0; fd < NOFILE; fd++){
+      if(np->ofile[fd]){
+        fileclose(np->ofile[fd]);
+        np->ofile[fd] = 0;
+      }
+    }
+    begin_op();
+    iput(np->cwd);
+    end_op();
+    np->cwd = 0;
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -469,8 +606,8 @@ exit(int status)
     panic("init exiting");
 
   // remove all mmaped-regions
-  while(p->vma) {
-    munmap(p, p->vma->addr, p->vma->length);
+  while(p->nvma > 0) {
+    munmap(p, p->vma[0].addr, p->vma[0].length);
   }
 
   // Close all open files.
@@ -484,8 +621,13 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip){
+    iexec(p->execip, -1);
+    iput(p->execip);
+  }
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
@@ -516,6 +658,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the copyout below is under locks.
+  if(addr != 0)
+    uvmprefault(p, addr, sizeof(int), 1);
+
   acquire(&wait_lock);
 
   for(;;){
@@ -582,7 +728,15 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+#ifdef KVMSHARE
+        // run p on its own page table, which maps the kernel
+        // too, so that its traps and system calls don't switch.
+        uvmswitch(p);
+#endif
         swtch(&c->context, &p->context);
+#ifdef KVMSHARE
+        kvmswitch();
+#endif
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
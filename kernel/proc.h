@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB was flushed for
 };
 
 extern struct cpu cpus[NCPU];
@@ -83,18 +84,48 @@ struct trapframe {
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 struct vma_region {
-  struct spinlock lock;
   uint64 addr;  // should always be page-aligned
   int length;
   int prot;
   int flags;
   struct file *f;
   int offset;
-  struct vma_region *next;
+  int advice;      // MADV_*
+  uint64 ranext;   // fault address that continues a sequential scan
 };
 
-#define VMA_REGION_COUNT 16
+#define VMA_REGION_COUNT 16  // mmap regions per process
 #define VMA_ADDR_START (MAXVA / 2)
+#define VMA_ADDR_END (TRAMPOLINE - 16*PGSIZE)  // below the special pages
+#ifdef KVMSHARE
+#define HEAPTOP PLIC  // the kernel's devices are mapped above; see kvmshare
+#else
+#define HEAPTOP VMA_ADDR_START  // end of the program and its heap
+#endif
+// first address after the pages of vma
+#define VMA_END(vma) ((vma)->addr + PGROUNDUP((uint64)(vma)->length))
+#define FAULTAROUND 16  // window of pages mapped on an mmap fault
+
+#define NEXECSEG 4  // loadable segments of a program
+
+// a loadable segment of the running program, which exec leaves
+// to be faulted in from the program file (see execfault)
+struct execseg {
+  uint64 va;       // start, page-aligned
+  uint64 fileend;  // end of the part read from the file
+  uint64 end;      // end, including the zero-filled bss
+  uint64 off;      // file offset of va
+  int perm;        // PTE_R, PTE_W and PTE_X
+};
+
+#define NUTLB 4  // user translations cached for copyin and copyout
+
+// a user page recently translated by copyin or copyout; see uvmtranslate
+struct utlb {
+  uint64 va;     // page-aligned user address
+  uint64 pa;     // the page it maps to
+  uint64 flags;  // the PTE's flags; 0 if the entry is unused
+};
 
 // all the data required to handle alarm
 struct alarmstate {
@@ -126,15 +157,30 @@ struct proc {
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
+  int nsleep;                  // sleep-locks held; see kfault
   uint64 sz;                   // Size of process memory (bytes)
+  int nlazy;                   // heap pages below sz not allocated yet
+  struct inode *execip;        // program file, while it is faulted in
+  struct execseg seg[NEXECSEG]; // the program's loadable segments
+  int nseg;                    // number of segments
+  uint64 execend;              // end of the program's pages
   pagetable_t pagetable;       // User page table
-  struct vma_region *vma;      // vma regions for mmap
+  struct utlb utlb[NUTLB];     // recent translations of pagetable
+  uint64 asid;                 // generation and ASID; see uvmsatp
+  uint tlbharts;               // harts that may hold p's translations
+  uint tlbstale;               // harts that must flush them before running p
+  struct spinlock vmalock;     // protects vma, nvma and vmahint
+  struct vma_region vma[VMA_REGION_COUNT]; // mmap regions, sorted by addr
+  int nvma;                    // number of regions in use
+  int vmahint;                 // index of the region last looked up
+  uint wbtick;                 // ticks at the last writeback pass
+  uint64 wbnext;               // where the next writeback pass starts
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   struct usyscall *usyscall;   // USYSCALL frame
   char name[16];               // Process name (debugging)
-  int tracemask;               // mask for syscall tracing
+  uint64 tracemask;            // mask for syscall tracing
   struct alarmstate alarm;     // data for alarm handling
 };
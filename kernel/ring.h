@@ -0,0 +1,32 @@
+// Submission and completion rings for ringenter(). The user
+// queues system calls in sq; one ringenter makes them, in
+// order, posting each one's result to cq.
+#define RING_READ   1  // read(fd, addr, n)
+#define RING_WRITE  2  // write(fd, addr, n)
+#define RING_OPEN   3  // open(addr, n)
+#define RING_CLOSE  4  // close(fd)
+
+#define RINGSIZE   16  // entries in each ring
+
+struct sqe {
+  int op;       // RING_*
+  int fd;
+  int n;        // byte count, or open mode
+  uint64 addr;  // buffer, or path
+  uint64 data;  // handed back in the completion
+};
+
+struct cqe {
+  uint64 data;  // the submission's
+  int res;      // what the call returned
+};
+
+// heads and tails count entries from 0 and wrap only as uints
+// do; entry i is at index i % RINGSIZE. the user advances
+// sqtail and cqhead, ringenter sqhead and cqtail.
+struct ring {
+  uint sqhead, sqtail;
+  uint cqhead, cqtail;
+  struct sqe sq[RINGSIZE];
+  struct cqe cq[RINGSIZE];
+};
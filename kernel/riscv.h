@@ -198,6 +198,12 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address-space identifier, which tags TLB entries, so that
+// satp can change without flushing them. 0 is the kernel's.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID(asid) ((uint64)(asid) << SATP_ASID_SHIFT)
+#define ASIDMASK 0xffffL  // at most 16 bits
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -246,6 +252,7 @@ r_stval()
 }
 
 // Machine-mode Counter-Enable
+#define MCOUNTEREN_TM (1L << 1)  // supervisor may read the time CSR
 static inline void 
 w_mcounteren(uint64 x)
 {
@@ -260,6 +267,22 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor Counter-Enable
+#define SCOUNTEREN_TM (1L << 1)  // user may read the time CSR
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -331,6 +354,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
+// flush the TLB entries for va of one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) : "memory");
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -338,6 +375,8 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define MEGAPGSIZE (1L << 21) // bytes per megapage, a leaf PTE at level 1
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
@@ -0,0 +1,14 @@
+// Actions on the child's open files for spawn(), applied in
+// order to a copy of the parent's.
+#define SPAWN_CLOSE  1  // close fd
+#define SPAWN_DUP2   2  // make fd a duplicate of descriptor arg
+#define SPAWN_OPEN   3  // open path at fd, with open mode arg
+
+#define NSPAWNACT   16  // most actions a spawn can take
+
+struct spawnact {
+  int op;
+  int fd;
+  int arg;
+  char *path;
+};
@@ -43,6 +43,10 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor mode, and through scounteren user
+  // mode, read the time CSR.
+  w_mcounteren(r_mcounteren() | MCOUNTEREN_TM);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "trace.h"
 
 // Fetch the uint64 at addr from the current process.
 int
@@ -141,6 +142,17 @@ extern uint64 sys_pgaccess(void);
 
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_vmsplice(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -178,41 +190,89 @@ static uint64 (*syscalls[])(void) = {
 [SYS_sysinfo] sys_sysinfo,
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
+[SYS_getdents] sys_getdents,
+[SYS_madvise] sys_madvise,
+[SYS_msync]   sys_msync,
+[SYS_spawn]   sys_spawn,
+[SYS_ringenter] sys_ringenter,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_sendfile] sys_sendfile,
+[SYS_vmsplice] sys_vmsplice,
 };
 
 static const char *syscall_names[] = {
-  "",
-  "fork",
-  "exit",
-  "wait",
-  "pipe",
-  "read",
-  "kill",
-  "exec",
-  "fstat",
-  "chdir",
-  "dup",
-  "getpid",
-  "sbrk",
-  "sleep",
-  "uptime",
-  "open",
-  "write",
-  "mknod",
-  "unlink",
-  "link",
-  "mkdir",
-  "close",
-  "sigalarm",
-  "sigreturn",
-  "connect",
-  "pgaccess",
-  "trace",
-  "sysinfo",
-  "mmap",
-  "munmap",
+[SYS_fork]      "fork",
+[SYS_exit]      "exit",
+[SYS_wait]      "wait",
+[SYS_pipe]      "pipe",
+[SYS_read]      "read",
+[SYS_kill]      "kill",
+[SYS_exec]      "exec",
+[SYS_fstat]     "fstat",
+[SYS_chdir]     "chdir",
+[SYS_dup]       "dup",
+[SYS_getpid]    "getpid",
+[SYS_sbrk]      "sbrk",
+[SYS_sleep]     "sleep",
+[SYS_uptime]    "uptime",
+[SYS_open]      "open",
+[SYS_write]     "write",
+[SYS_mknod]     "mknod",
+[SYS_unlink]    "unlink",
+[SYS_link]      "link",
+[SYS_mkdir]     "mkdir",
+[SYS_close]     "close",
+[SYS_trace]     "trace",
+[SYS_sysinfo]   "sysinfo",
+[SYS_sigalarm]  "sigalarm",
+[SYS_sigreturn] "sigreturn",
+[SYS_symlink]   "symlink",
+[SYS_connect]   "connect",
+[SYS_pgaccess]  "pgaccess",
+[SYS_mmap]      "mmap",
+[SYS_munmap]    "munmap",
+[SYS_getdents]  "getdents",
+[SYS_madvise]   "madvise",
+[SYS_msync]     "msync",
+[SYS_spawn]     "spawn",
+[SYS_ringenter] "ringenter",
+[SYS_readv]     "readv",
+[SYS_writev]    "writev",
+[SYS_pread]     "pread",
+[SYS_pwrite]    "pwrite",
+[SYS_sendfile]  "sendfile",
+[SYS_vmsplice]  "vmsplice",
 };
 
+// Make system call num for p, which traces it: into the
+// trace device's rings if they are on, else to the console.
+static void
+tracesyscall(struct proc *p, int num)
+{
+  struct trapframe *tf = p->trapframe;
+  struct tracerec r;
+
+  r.pid = p->pid;
+  r.num = num;
+  r.arg[0] = tf->a0;
+  r.arg[1] = tf->a1;
+  r.arg[2] = tf->a2;
+  r.arg[3] = tf->a3;
+  r.arg[4] = tf->a4;
+  r.arg[5] = tf->a5;
+  r.start = r_time();
+  tf->a0 = syscalls[num]();
+  r.end = r_time();
+  r.ret = tf->a0;
+  if(traceput(&r) < 0) {
+    printf("%d: syscall %s -> %d\n",
+            p->pid, syscall_names[num], tf->a0);
+  }
+}
+
 void
 syscall(void)
 {
@@ -220,12 +280,12 @@ syscall(void)
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
+  utlbflush(p->pagetable);
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    p->trapframe->a0 = syscalls[num]();
-    if(1 << num & p->tracemask) {
-      printf("%d: syscall %s -> %d\n",
-              p->pid, syscall_names[num], p->trapframe->a0);
-    }
+    if(num < 64 && ((1L << num) & p->tracemask))
+      tracesyscall(p, num);
+    else
+      p->trapframe->a0 = syscalls[num]();
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
@@ -30,3 +30,14 @@
 #define SYS_pgaccess  30
 #define SYS_mmap   31
 #define SYS_munmap 32
+#define SYS_getdents 33
+#define SYS_madvise  34
+#define SYS_msync    35
+#define SYS_spawn    36
+#define SYS_ringenter 37
+#define SYS_readv    38
+#define SYS_writev   39
+#define SYS_pread    40
+#define SYS_pwrite   41
+#define SYS_sendfile 42
+#define SYS_vmsplice 43
@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
+#include "ring.h"
+#include "uio.h"
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
@@ -56,6 +59,9 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  // fileread may copy out with locks held.
+  if(n > 0)
+    uvmprefault(myproc(), p, n, 1);
   return fileread(f, p, n);
 }
 
@@ -68,10 +74,130 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  if(n > 0)
+    uvmprefault(myproc(), p, n, 0);
 
   return filewrite(f, p, n);
 }
 
+// Fetch the niov buffers of user iovec array uiov into iov,
+// and fault in the program's pages among them, since file
+// reads and writes may copy with locks held.
+static int
+fetchiov(uint64 uiov, int niov, struct iovec *iov, int write)
+{
+  uint64 total = 0;
+  int i;
+  struct proc *p = myproc();
+
+  if(niov < 0 || niov > IOV_MAX ||
+     copyin(p->pagetable, (char*)iov, uiov, niov*sizeof(*iov)) < 0)
+    return -1;
+  for(i = 0; i < niov; i++){
+    total += iov[i].iov_len;
+    if(iov[i].iov_len > 0x7fffffff || total > 0x7fffffff)
+      return -1;
+    uvmprefault(p, (uint64)iov[i].iov_base, iov[i].iov_len, write);
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct iovec iov[IOV_MAX];
+  struct file *f;
+  uint64 uiov;
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &uiov) < 0 || argint(2, &niov) < 0 ||
+     fetchiov(uiov, niov, iov, 1) < 0)
+    return -1;
+  return filereadv(f, iov, niov);
+}
+
+uint64
+sys_writev(void)
+{
+  struct iovec iov[IOV_MAX];
+  struct file *f;
+  uint64 uiov;
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &uiov) < 0 || argint(2, &niov) < 0 ||
+     fetchiov(uiov, niov, iov, 0) < 0)
+    return -1;
+  return filewritev(f, iov, niov);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  uvmprefault(myproc(), p, n, 1);
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  uvmprefault(myproc(), p, n, 0);
+  return filepwrite(f, p, n, off);
+}
+
+// sendfile(out, in, off, n): move n bytes from in to out inside
+// the kernel. A file is read at off, or if off is -1 at its own
+// offset, which advances; a pipe only with off -1.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+  uint uoff;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 ||
+     argint(2, &off) < 0 || argint(3, &n) < 0)
+    return -1;
+  if(off == -1)
+    return filesend(out, in, &in->off, n);
+  if(off < 0 || in->type != FD_INODE)
+    return -1;
+  uoff = off;
+  return filesend(out, in, &uoff, n);
+}
+
+// vmsplice(fd, addr, n): write to pipe fd like write, but give
+// it the whole pages of an anonymous mapping rather than copy
+// them; they read as zeros afterwards.
+uint64
+sys_vmsplice(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(f->type != FD_PIPE || f->writable == 0)
+    return -1;
+  if(n > 0)
+    uvmprefault(myproc(), p, n, 0);
+  return pipegift(f->pipe, p, n);
+}
+
 uint64
 sys_close(void)
 {
@@ -96,6 +222,18 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 buf; // user pointer to struct direntplus[n]
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filegetdents(f, buf, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -146,22 +284,6 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
@@ -256,25 +378,31 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  if(dirlink(dp, name, ip->inum) < 0){
+    // dp is full; give back the new inode.
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
 
   iunlockput(dp);
 
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for sys_open or a spawn action.
+// Returns the new file, or 0.
+static struct file*
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -282,33 +410,38 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  // a running program may not be changed (see iexec).
+  if((omode & (O_WRONLY|O_RDWR|O_TRUNC)) && iexecuting(ip)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
+  }
+
+  if((f = filealloc()) == 0){
+    iunlockput(ip);
+    end_op();
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -329,6 +462,25 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -393,23 +545,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argv array at uargv, and its strings, into
+// argv[MAXARG], one kalloc'd page per string. On failure the
+// caller must still freeargv.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -417,24 +568,176 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
 
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
+
+// spawn(path, argv, acts, nact): start a child running path,
+// with the parent's open files changed by the nact fd actions
+// in acts. See spawn.h.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], apath[MAXPATH], *argv[MAXARG];
+  struct file *ofile[NOFILE], *f;
+  struct spawnact act;
+  uint64 uargv, uacts;
+  int i, fd, nact, ret = -1;
+  struct proc *p = myproc();
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uacts) < 0 || argint(3, &nact) < 0 ||
+     nact < 0 || nact > NSPAWNACT){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    goto out;
+
+  for(fd = 0; fd < NOFILE; fd++)
+    ofile[fd] = p->ofile[fd] ? filedup(p->ofile[fd]) : 0;
+  for(i = 0; i < nact; i++){
+    if(copyin(p->pagetable, (char*)&act, uacts + i*sizeof(act), sizeof(act)) < 0 ||
+       act.fd < 0 || act.fd >= NOFILE)
+      goto bad;
+    switch(act.op){
+    case SPAWN_CLOSE:
+      f = 0;
+      break;
+    case SPAWN_DUP2:
+      if(act.arg < 0 || act.arg >= NOFILE || ofile[act.arg] == 0)
+        goto bad;
+      f = filedup(ofile[act.arg]);
+      break;
+    case SPAWN_OPEN:
+      if(fetchstr((uint64)act.path, apath, MAXPATH) < 0 ||
+         (f = openfile(apath, act.arg)) == 0)
+        goto bad;
+      break;
+    default:
+      goto bad;
+    }
+    if(ofile[act.fd])
+      fileclose(ofile[act.fd]);
+    ofile[act.fd] = f;
+  }
+
+  ret = spawn(path, argv, ofile);
+  goto out;
 
  bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(ofile[fd])
+      fileclose(ofile[fd]);
+ out:
+  freeargv(argv);
+  return ret;
+}
+
+// Make the system call that submission e asks for; return its
+// result.
+static int
+ringop(struct sqe *e)
+{
+  char path[MAXPATH];
+  struct file *f;
+  int fd;
+  struct proc *p = myproc();
+
+  if(e->op == RING_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0 || (f = openfile(path, e->n)) == 0)
+      return -1;
+    if((fd = fdalloc(f)) < 0){
+      fileclose(f);
+      return -1;
+    }
+    return fd;
+  }
+
+  if(e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case RING_READ:
+    if(e->n > 0)
+      uvmprefault(p, e->addr, e->n, 1);
+    return fileread(f, e->addr, e->n);
+  case RING_WRITE:
+    if(e->n > 0)
+      uvmprefault(p, e->addr, e->n, 0);
+    return filewrite(f, e->addr, e->n);
+  case RING_CLOSE:
+    p->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  }
   return -1;
 }
 
+// ringenter(ring): make the system calls queued in ring's
+// submission ring, in order, while its completion ring has
+// room, and post their results. Returns how many were made.
+// See ring.h.
+uint64
+sys_ringenter(void)
+{
+  struct ring *r;
+  struct sqe e;
+  struct cqe c;
+  uint64 ur;
+  uint idx[4];  // sqhead, sqtail, cqhead, cqtail
+  int n = 0;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &ur) < 0 ||
+     copyin(p->pagetable, (char*)idx, ur, sizeof(idx)) < 0)
+    return -1;
+  r = (struct ring*)ur;
+
+  while(idx[0] != idx[1] && idx[3] - idx[2] < RINGSIZE && !p->killed){
+    if(copyin(p->pagetable, (char*)&e, (uint64)&r->sq[idx[0] % RINGSIZE],
+              sizeof(e)) < 0)
+      break;
+    c.data = e.data;
+    c.res = ringop(&e);
+    if(copyout(p->pagetable, (uint64)&r->cq[idx[3] % RINGSIZE], (char*)&c,
+               sizeof(c)) < 0)
+      break;
+    idx[0]++;
+    idx[3]++;
+    n++;
+  }
+
+  if(copyout(p->pagetable, (uint64)&r->sqhead, (char*)&idx[0], sizeof(uint)) < 0 ||
+     copyout(p->pagetable, (uint64)&r->cqtail, (char*)&idx[3], sizeof(uint)) < 0)
+    return -1;
+  return n;
+}
+
 uint64
 sys_pipe(void)
 {
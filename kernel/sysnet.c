@@ -136,17 +136,20 @@ sockread(struct sock *si, uint64 addr, int n)
   return len;
 }
 
+// Send the n bytes at addr, a user address if user_src, else a
+// kernel one, as one datagram.
 int
-sockwrite(struct sock *si, uint64 addr, int n)
+sockwrite(struct sock *si, int user_src, uint64 addr, int n)
 {
-  struct proc *pr = myproc();
   struct mbuf *m;
 
+  if (n < 0 || n > MBUF_SIZE - MBUF_DEFAULT_HEADROOM)
+    return -1;
   m = mbufalloc(MBUF_DEFAULT_HEADROOM);
   if (!m)
     return -1;
 
-  if (copyin(pr->pagetable, mbufput(m, n), addr, n) == -1) {
+  if (either_copyin(mbufput(m, n), user_src, addr, n) == -1) {
     mbuffree(m);
     return -1;
   }
@@ -7,6 +7,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sysinfo.h"
+#include "fcntl.h"
 
 uint64
 sys_exit(void)
@@ -133,12 +134,15 @@ sys_mmap(void)
     argint(1, &length) < 0 ||
     argint(2, &prot) < 0 ||
     argint(3, &flags) < 0 ||
-    argfd(4, 0, &f) < 0 ||
     argint(5, &offset) < 0) {
     return -1;
   }
+  f = 0;
+  if(!(flags & MAP_ANONYMOUS) && (argfd(4, 0, &f) < 0 || f == 0)) {
+    return -1;
+  }
 
-  if(length < 0 || f == 0) {
+  if(length < 0) {
     return -1;
   }
 
@@ -162,11 +166,46 @@ sys_munmap(void)
   return munmap(myproc(), addr, length);
 }
 
+uint64
+sys_madvise(void)
+{
+  uint64 addr;
+  int length;
+  int advice;
+
+  if(argaddr(0, &addr) < 0 ||
+    argint(1, &length) < 0 ||
+    argint(2, &advice) < 0) {
+    return -1;
+  }
+  if(length < 0) {
+    return -1;
+  }
+
+  return madvise(myproc(), addr, length, advice);
+}
+
+uint64
+sys_msync(void)
+{
+  uint64 addr;
+  int length;
+  int flags;
+
+  if(argaddr(0, &addr) < 0 ||
+    argint(1, &length) < 0 ||
+    argint(2, &flags) < 0) {
+    return -1;
+  }
+
+  return msync(myproc(), addr, length, flags);
+}
+
 uint64
 sys_trace(void)
 {
-  int mask;
-  if(argint(0, &mask) < 0) {
+  uint64 mask;
+  if(argaddr(0, &mask) < 0) {
     return -1;
   }
   myproc()->tracemask = mask;
@@ -0,0 +1,108 @@
+// Rings of traced system calls, one per CPU, read through
+// the trace device. Only its own CPU writes a ring, with
+// interrupts off, so writing takes no lock: the oldest records
+// are overwritten, and the reader finds out afterwards if one
+// was while it copied it.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "trace.h"
+
+#define NTRACEREC 256  // records in each CPU's ring
+
+struct tracering {
+  uint64 started;  // records whose writing has begun
+  uint64 head;     // records written
+  uint64 tail;     // records read; only the reader uses it
+  struct tracerec rec[NTRACEREC];
+};
+
+static struct {
+  struct sleeplock lock;  // one reader at a time
+  int on;                 // record, rather than print
+  struct tracering ring[NCPU];
+} trace;
+
+// Record r in this CPU's ring, if recording is on.
+// Returns 0, or -1 if it is off.
+int
+traceput(struct tracerec *r)
+{
+  struct tracering *t;
+  uint64 h;
+
+  if(!trace.on)
+    return -1;
+  push_off();
+  t = &trace.ring[cpuid()];
+  h = t->head;
+  __atomic_store_n(&t->started, h + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  t->rec[h % NTRACEREC] = *r;
+  __atomic_store_n(&t->head, h + 1, __ATOMIC_RELEASE);
+  pop_off();
+  return 0;
+}
+
+// Copy whole records from the rings to dst, oldest first on each
+// CPU. Returns the number of bytes, 0 if there are none yet.
+int
+traceread(int user_dst, uint64 dst, int n)
+{
+  struct tracering *t;
+  struct tracerec r;
+  uint64 h;
+  int i, got = 0;
+
+  if(n < 0)
+    return -1;
+  acquiresleep(&trace.lock);
+  for(i = 0; i < NCPU && n - got >= sizeof(r); i++){
+    t = &trace.ring[i];
+    h = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    if(h - t->tail > NTRACEREC)
+      t->tail = h - NTRACEREC;  // the rest were overwritten
+    for(; t->tail < h && n - got >= sizeof(r); t->tail++){
+      r = t->rec[t->tail % NTRACEREC];
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      // was the record after it NTRACEREC begun meanwhile?
+      if(__atomic_load_n(&t->started, __ATOMIC_RELAXED) - t->tail > NTRACEREC)
+        continue;
+      if(either_copyout(user_dst, dst + got, (char*)&r, sizeof(r)) < 0){
+        releasesleep(&trace.lock);
+        return got > 0 ? got : -1;
+      }
+      got += sizeof(r);
+    }
+  }
+  releasesleep(&trace.lock);
+  return got;
+}
+
+// "1" turns recording on, "0" back off.
+int
+tracewrite(int user_src, uint64 src, int n)
+{
+  char c;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) < 0)
+    return -1;
+  if(c != '0' && c != '1')
+    return -1;
+  __atomic_store_n(&trace.on, c == '1', __ATOMIC_RELEASE);
+  return n;
+}
+
+void
+traceinit(void)
+{
+  initsleeplock(&trace.lock, "trace");
+  devsw[TRACE].read = traceread;
+  devsw[TRACE].write = tracewrite;
+}
@@ -0,0 +1,11 @@
+// Records of traced system calls, as read from the trace
+// device. Writing "1" to the device turns recording on; until
+// then, and after "0", traced calls are printed on the console.
+struct tracerec {
+  int pid;
+  int num;         // SYS_*
+  uint64 arg[6];   // a0-a5 on entry
+  uint64 ret;      // the call's return value
+  uint64 start;    // time CSR at entry
+  uint64 end;      // and at return
+};
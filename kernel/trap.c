@@ -8,6 +8,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+struct vdso *vdso;  // the VDSO page
 
 extern char trampoline[], uservec[], userret[];
 
@@ -20,6 +21,10 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("trapinit: vdso");
+  memset(vdso, 0, PGSIZE);
+  vdso->nspertime = NSPERTIME;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +32,9 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+  // let user code read the time CSR, for uclock().
+  w_scounteren(r_scounteren() | SCOUNTEREN_TM);
+  __sync_fetch_and_add(&vdso->ncpu, 1);
 }
 
 // return from alarm handler - move everything back
@@ -82,20 +90,9 @@ usertrap(void)
   case 12:  // instruction page fault
   case 13:  // load page fault
   case 15:  // store/AMO page fault
-    int ret;
-    // mmap handling
-    if((ret = handle_mmap(p, cause, r_stval())) == 0) {
-      break;
-    }
-    if(ret == -1) {
-      // mmap region not found, fall back to COW
-      uint64 va = r_stval();
-      if(cowcopypage(myproc()->pagetable, va) == 0) {
-        break;
-      }
-    }
-    // both failed
-    p->killed = 1;
+    // mmap regions, the program, the lazy heap and copy-on-write
+    if(uvmfault(p, cause, r_stval()) < 0)
+      p->killed = 1;
     break;
   default:
     if((which_dev = devintr()) != 0){
@@ -127,6 +124,7 @@ usertrap(void)
         p->trapframe->epc = (uint64)p->alarm.handler;
       }
     }
+    vma_wbtick(p);
     yield();
   }
 
@@ -168,8 +166,13 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with p's ASID.
+#ifdef KVMSHARE
+  uint64 satp = r_satp();  // loaded already, by the scheduler or exec
+#else
+  uint64 satp = uvmsatp(p);
+#endif
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -212,8 +215,12 @@ kerneltrap()
 void
 clockintr()
 {
+  uint64 freemem = kgetfreefast();
+
   acquire(&tickslock);
   ticks++;
+  vdso->ticks = ticks;
+  vdso->freemem = freemem;
   wakeup(&ticks);
   release(&tickslock);
 }
@@ -0,0 +1,7 @@
+// Buffers for readv() and writev().
+#define IOV_MAX 16  // most buffers one call takes
+
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
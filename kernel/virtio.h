@@ -45,7 +45,9 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// each request takes three, so up to NUM/3 requests
+// can be in flight at once (see virtio_disk_write_batch()).
+#define NUM 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
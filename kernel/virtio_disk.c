@@ -200,12 +200,15 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// format the three descriptors of a request that moves b->data
+// to or from disk block blockno, and hand it to the device.
+// caller must hold disk.vdisk_lock.
+// returns the index of the first descriptor of the chain,
+// or -1 if there are not enough free descriptors.
+static int
+virtio_disk_submit(struct buf *b, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
@@ -213,12 +216,8 @@ virtio_disk_rw(struct buf *b, int write)
 
   // allocate the three descriptors.
   int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  if(alloc3_desc(idx) != 0)
+    return -1;
 
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
@@ -268,13 +267,67 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
+  return idx[0];
+}
+
+// wait for the request for b, whose chain starts at
+// descriptor head, to finish, then free its descriptors.
+// caller must hold disk.vdisk_lock.
+static void
+virtio_disk_wait(struct buf *b, int head)
+{
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  disk.info[head].b = 0;
+  free_chain(head);
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  int head;
+
+  acquire(&disk.vdisk_lock);
+
+  while((head = virtio_disk_submit(b, b->blockno, write)) < 0){
+    sleep(&disk.free[0], &disk.vdisk_lock);
+  }
+  virtio_disk_wait(b, head);
+
+  release(&disk.vdisk_lock);
+}
+
+// write bs[i]->data to disk block blocknos[i], for each i < n,
+// keeping as many requests in flight as there are descriptors
+// for, and return once all of them are on disk.
+// the device may complete the writes in any order.
+void
+virtio_disk_write_batch(struct buf **bs, uint *blocknos, int n)
+{
+  // head descriptor of each in-flight request, indexed by
+  // position in bs[] modulo NUM. at most NUM/3 are in flight.
+  int heads[NUM];
+  int i, done;
+
+  acquire(&disk.vdisk_lock);
+
+  done = 0;
+  for(i = 0; i < n; i++){
+    while((heads[i % NUM] = virtio_disk_submit(bs[i], blocknos[i], 1)) < 0){
+      if(done < i){
+        // our own requests hold the descriptors; reap the oldest.
+        virtio_disk_wait(bs[done], heads[done % NUM]);
+        done++;
+      } else {
+        sleep(&disk.free[0], &disk.vdisk_lock);
+      }
+    }
+  }
+  for(; done < n; done++)
+    virtio_disk_wait(bs[done], heads[done % NUM]);
 
   release(&disk.vdisk_lock);
 }
@@ -10,6 +10,8 @@
 #include "fcntl.h"
 #include "fs.h"
 #include "file.h"
+#include "stat.h"
+#include "pcache.h"
 
 /*
  * the kernel's page table.
@@ -18,6 +20,30 @@ pagetable_t kernel_pagetable;
 
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
+// a page of zeros, mapped copy-on-write wherever a load faults
+// in a page that nothing has been stored to yet. never freed:
+// the reference from kvminit keeps it above 1 while mapped.
+static char *zeropage;
+
+// address-space identifiers for user page tables, handed out in
+// generations: when a generation's run out, the next one starts
+// over from 1, and each hart flushes its whole TLB before it next
+// loads an ASID, so that nothing of the last generation remains.
+#define ASIDGEN (ASIDMASK + 1)  // one generation, in p->asid
+#define TLBFLUSHPAGES 16        // more than this, flush the whole ASID
+
+static struct {
+  struct spinlock lock;
+  uint64 max;   // largest ASID the hardware keeps; 0 if it has none
+  uint64 gen;   // current generation, a multiple of ASIDGEN
+  uint64 next;  // next ASID of this generation to hand out
+} asids;
+
+struct vma_region *vma_lookup(struct proc *, uint64);
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+static int mapcached(pagetable_t, uint64, struct inode *, uint, int, int);
+static void tlbflush(struct proc *, uint64, uint64);
+
 extern char trampoline[]; // trampoline.S
 
 // Make a direct-map page table for the kernel.
@@ -67,6 +93,12 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asids");
+  asids.gen = ASIDGEN;
+  asids.next = 1;
+
+  zeropage = kalloc();
+  memset(zeropage, 0, PGSIZE);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -74,10 +106,134 @@ kvminit(void)
 void
 kvminithart()
 {
+  if(cpuid() == 0){
+    // how many ASID bits the hardware has: those that stick.
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(ASIDMASK));
+    asids.max = (r_satp() >> SATP_ASID_SHIFT) & ASIDMASK;
+  }
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// The satp to run p with: its page table, tagged with an ASID of
+// the current generation if the hardware has ASIDs. Flushes what
+// this hart's TLB may hold under that ASID that is out of date:
+// all of it, for a generation this hart has not flushed for, or
+// p's translations, if they changed while p ran on another hart.
+// Call with interrupts off, on the hart that will load it.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint bit = 1 << cpuid();
+  uint64 gen;
+
+  if(asids.max == 0)
+    return MAKE_SATP(p->pagetable);
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if((p->asid & ~ASIDMASK) != gen){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      asids.gen += ASIDGEN;
+      asids.next = 1;
+    }
+    p->asid = asids.gen | asids.next++;
+    gen = asids.gen;
+    release(&asids.lock);
+    p->tlbharts = 0;
+    p->tlbstale = 0;
+  }
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(p->tlbstale & bit){
+    sfence_vma_asid(p->asid & ASIDMASK);
+  }
+  p->tlbstale &= ~bit;
+  p->tlbharts |= bit;
+  return MAKE_SATP(p->pagetable) | SATP_ASID(p->asid & ASIDMASK);
+}
+
+#ifdef KVMSHARE
+// Map the kernel into user page table pagetable too, not
+// PTE_U, so that a process can run in the kernel on its own
+// page table, and traps need not switch (see trampoline.S).
+// Level-2 entries of the kernel's that no user address falls
+// in are shared, with the page-table pages under them; in the
+// first gigabyte, which the program and heap start at, the
+// kernel's level-1 entries for its devices are copied into a
+// page of pagetable's own. The heap stays below them (HEAPTOP),
+// and mmap regions above VMA_ADDR_START, out of the kernel's
+// way. The trampoline is pagetable's own, as it always was.
+// Returns 0, or -1 if out of memory.
+int
+kvmshare(pagetable_t pagetable)
+{
+  pagetable_t l1, kl1;
+  int i, j;
+
+  for(i = 0; i < 512; i++){
+    if((kernel_pagetable[i] & PTE_V) == 0 || i == PX(2, TRAMPOLINE))
+      continue;
+    if(i >= PX(2, VMA_ADDR_START))
+      panic("kvmshare: kernel in mmap space");
+    if(i != PX(2, 0)){
+      pagetable[i] = kernel_pagetable[i];
+      continue;
+    }
+    if((l1 = (pagetable_t)kalloc()) == 0)
+      return -1;
+    memset(l1, 0, PGSIZE);
+    kl1 = (pagetable_t)PTE2PA(kernel_pagetable[i]);
+    for(j = PX(1, HEAPTOP); j < 512; j++)
+      l1[j] = kl1[j];
+    pagetable[i] = PA2PTE(l1) | PTE_V;
+  }
+  return 0;
+}
+
+// Run on p's page table, for the scheduler and exec.
+void
+uvmswitch(struct proc *p)
+{
+  w_satp(uvmsatp(p));
+  if(asids.max == 0)
+    sfence_vma();
+}
+
+// Back to the kernel's page table, as p's may be freed now.
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+  if(asids.max == 0)
+    sfence_vma();
+}
+
+// Take the kernel out of pagetable again before it is freed,
+// so that freewalk leaves the kernel's page-table pages alone.
+void
+kvmunshare(pagetable_t pagetable)
+{
+  pagetable_t l1, kl1;
+  int i, j;
+
+  for(i = 0; i < 512; i++){
+    if((kernel_pagetable[i] & PTE_V) == 0 || (pagetable[i] & PTE_V) == 0)
+      continue;
+    if(pagetable[i] == kernel_pagetable[i]){
+      pagetable[i] = 0;
+    } else if(i == PX(2, 0)){
+      l1 = (pagetable_t)PTE2PA(pagetable[i]);
+      kl1 = (pagetable_t)PTE2PA(kernel_pagetable[i]);
+      for(j = PX(1, HEAPTOP); j < 512; j++)
+        if(l1[j] == kl1[j])
+          l1[j] = 0;
+    }
+  }
+}
+#endif
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -90,15 +246,28 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE may also sit at level 1, mapping a 2-megabyte
+// megapage; only the kernel page table has those. If va is in
+// one, its level-1 PTE is returned.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk, but return the PTE for va at level (0 or 1).
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int target, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > target; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        return pte;  // megapage
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -107,7 +276,30 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(target, va)];
+}
+
+// Return the last-level page-table page that maps va, if any.
+// Sets *next to where the caller should look next: the end of
+// the range that page maps, or of the hole in the upper levels
+// of the page table around va, but no further than end.
+static pagetable_t
+walkl0(pagetable_t pagetable, uint64 va, uint64 end, uint64 *next)
+{
+  int level;
+  uint64 span;
+
+  for(level = 2; level > 0; level--) {
+    pte_t pte = pagetable[PX(level, va)];
+    if((pte & PTE_V) == 0)
+      break;
+    pagetable = (pagetable_t)PTE2PA(pte);
+  }
+  span = 1L << PXSHIFT(level == 0 ? 1 : level);
+  *next = (va & ~(span - 1)) + span;
+  if(*next > end)
+    *next = end;
+  return level == 0 ? pagetable : 0;
 }
 
 // Look up a virtual address, return the physical address,
@@ -140,15 +332,24 @@ vm_pgaccess(pagetable_t pgtbl, uint64 start_addr, int pg_cnt, char *ubuf)
     printf("pgaccess: pg_cnt too large\n");
     return -1;
   }
+#ifdef KVMSHARE
+  // above HEAPTOP are the kernel's page-table pages.
+  if(start_addr < VMA_ADDR_START &&
+     start_addr + (uint64)pg_cnt * PGSIZE > HEAPTOP)
+    return -1;
+#endif
   uint64 va = start_addr;
+  int npages = pg_cnt;
   int byte_cnt = (pg_cnt + 7) / 8;
   char *kbuf = kalloc();
   memset(kbuf, 0, byte_cnt);
   int i = 0;
   while(pg_cnt) {
-    pte_t *ptea = walk(pgtbl, va, 0);
+    // the lazy heap may not have this page-table page yet.
+    pte_t *ptea = walk(pgtbl, va, 1);
     printf("Walking va %p\n", va);
     if(!ptea) {
+      kfree(kbuf);
       return -1;
     }
 
@@ -159,9 +360,8 @@ vm_pgaccess(pagetable_t pgtbl, uint64 start_addr, int pg_cnt, char *ubuf)
     for(;i < pg_cnt && ptea + i - start_i < pt_end; i++) {
       pte_t pte = ptea[i - start_i];
       if((pte & PTE_V) == 0) {
-        // invalid
-        kfree(kbuf);
-        return -1;
+        // not faulted in yet, so not accessed either
+        continue;
       }
       // set bitmask
       kbuf[i / 8] |= (PTE_ACCESSED(pte) << (i & 7));
@@ -178,6 +378,9 @@ vm_pgaccess(pagetable_t pgtbl, uint64 start_addr, int pg_cnt, char *ubuf)
     }
   }
 
+  // so that the next access sets PTE_A again.
+  uvmflush(pgtbl, start_addr, npages);
+
   // copy buffer & exit
   int ret = copyout(pgtbl, (uint64)ubuf, kbuf, byte_cnt);
   kfree(kbuf);
@@ -187,11 +390,34 @@ vm_pgaccess(pagetable_t pgtbl, uint64 start_addr, int pg_cnt, char *ubuf)
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// uses a megapage wherever va and pa are both 2-megabyte aligned
+// and at least that much is left to map, so that the direct map
+// of RAM takes a few page-table pages and TLB entries rather
+// than one for every 4096 bytes.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 a, end;
+  pte_t *pte;
+
+  a = PGROUNDDOWN(va);
+  end = PGROUNDUP(va + sz);
+  while(a < end){
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE){
+      if((pte = walklevel(kpgtbl, a, 1, 1)) == 0)
+        panic("kvmmap");
+      if(*pte & PTE_V)
+        panic("kvmmap: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      a += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+    } else {
+      if(mappages(kpgtbl, a, PGSIZE, pa, perm) != 0)
+        panic("kvmmap");
+      a += PGSIZE;
+      pa += PGSIZE;
+    }
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -271,62 +497,73 @@ cowcopypage(pagetable_t pagetable, uint64 va)
     return -1;
   }
 
+  // no lock is needed. while the page is shared, our reference
+  // keeps it around to copy from, and krefput lets exactly one
+  // of the sharers free it. once ours is the last reference,
+  // nothing can take another (only this process could, by
+  // forking), so the page is simply reused.
   pa = PTE2PA(*pte);
   new_pte = *pte; // default
   if(kref(pa) > 1) {
     // allocate a new page, copy into it
-    krefacquire();
-    if(kref(pa) > 1) {
-      void *new_pa = kalloc();
-      if(new_pa == 0) {
-        printf("cowcopypage: kalloc");
-        krefrelease();
-        return -1;
-      }
-      memmove(new_pa, (const void *)pa, PGSIZE);
-      // reduce reference counter of old page
-      krefdec(pa);
-      new_pte = PA2PTE((uint64)new_pa) | PTE_FLAGS(*pte);
+    void *new_pa = kalloc();
+    if(new_pa == 0) {
+      printf("cowcopypage: kalloc\n");
+      return -1;
     }
-    krefrelease();
+    memmove(new_pa, (const void *)pa, PGSIZE);
+    new_pte = PA2PTE((uint64)new_pa) | PTE_FLAGS(*pte);
   }
   new_pte |= PTE_W;
   new_pte &= ~PTE_COW;
   *pte = new_pte;
+  uvmflush(pagetable, PGROUNDDOWN(va), 1);
+  if(PTE2PA(new_pte) != pa) {
+    // reduce reference counter of old page
+    krefput(pa);
+  }
   return 0;
 }
 
+// Drop a mapping's reference to page pa, freeing it if that
+// was the last: the page may be shared if it is COW, or a
+// page-cache page that is mapped MAP_SHARED.
+static void
+putpage(uint64 pa)
+{
+  krefput(pa);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages of a lazily grown heap that were never
+// touched (see growproc) have no mapping, and are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, next, end;
+  pagetable_t l0;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0) {
-      printf("va=%p pte=%p\n", a, *pte);
-      panic("uvmunmap: not mapped");
-    }
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
-    if(do_free) {
-      uint64 pa = PTE2PA(*pte);
-      if((*pte & PTE_COW) && kref(pa) > 1) {
-        krefdec(pa);
-      } else {
-        kfree((void*)pa);
-      }
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    if((l0 = walkl0(pagetable, a, end, &next)) == 0)
+      continue;
+    for(; a < next; a += PGSIZE){
+      pte = &l0[PX(0, a)];
+      if((*pte & PTE_V) == 0)
+        continue;
+      if(PTE_FLAGS(*pte) == PTE_V)
+        panic("uvmunmap: not a leaf");
+      if(do_free)
+        putpage(PTE2PA(*pte));
+      *pte = 0;
     }
-    *pte = 0;
   }
+  uvmflush(pagetable, va, npages);
 }
 
 // create an empty user page table.
@@ -434,58 +671,97 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
-// returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
+// Count the pages of [va, va+npages*PGSIZE) that have no page
+// of their own yet: not faulted in, or mapping the zero page.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 npages)
 {
+  uint64 a, next, end = va + npages*PGSIZE;
+  pagetable_t l0;
   pte_t *pte;
-  uint64 pa, i;
+  int n = 0;
+
+  for(a = va; a < end; a = next){
+    if((l0 = walkl0(pagetable, a, end, &next)) == 0){
+      n += (next - a) / PGSIZE;
+      continue;
+    }
+    for(; a < next; a += PGSIZE){
+      pte = &l0[PX(0, a)];
+      if((*pte & PTE_V) == 0 || PTE2PA(*pte) == (uint64)zeropage)
+        n++;
+    }
+  }
+  return n;
+}
+
+// Copy the mappings of [start, end) from old into new, which
+// must have none there, a last-level page-table page at a time:
+// one walk of each page table per 2 megabytes rather than per
+// page. Writable pages become copy-on-write in both, unless
+// share is set. Every page copied gets another reference.
+// Returns 0, or -1 if out of memory for page-table pages.
+static int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end,
+             int share)
+{
+  pagetable_t l0, nl0;
+  pte_t *pte, *npte;
+  uint64 va, next, pa;
   uint flags;
-  // printf("Old one:\n");
-  // vmprint(old);
-
-  for(i = 0; i < sz; i += PGSIZE) {
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-
-    // printf("Copying mapping %p -> %p, flags %x\n", i, pa, flags);
-
-    if(flags & PTE_W) {
-      // printf("Using COW\n");
-      // COW: map parent's pages into child's pgtbl
-      flags &= ~PTE_W;
-      flags |= PTE_COW;  // COW bit
-      if(mappages(new, i, PGSIZE, pa, flags) != 0) {
-        goto err;
+  int r = 0;
+
+  for(va = start; va < end; va = next) {
+    // holes in the heap not touched yet stay that way in new.
+    if((l0 = walkl0(old, va, end, &next)) == 0)
+      continue;
+    nl0 = 0;
+    for(; va < next; va += PGSIZE) {
+      pte = &l0[PX(0, va)];
+      if((*pte & PTE_V) == 0)
+        continue;
+      if(nl0 == 0) {
+        if((npte = walk(new, va, 1)) == 0) {
+          r = -1;
+          goto out;
+        }
+        nl0 = (pagetable_t)PGROUNDDOWN((uint64)npte);
       }
-      *pte = PA2PTE(pa) | flags;
-      // add reference counter
-      krefinc(pa);
-    } else {
-      // printf("Using regular sharing\n");
-      // page is not writeable, just map it
-      if(mappages(new, i, PGSIZE, pa, flags) != 0) {
-        goto err;
+      npte = &nl0[PX(0, va)];
+      if(*npte & PTE_V)
+        panic("uvmcopyrange: remap");
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      if(!share && (flags & PTE_W)) {
+        // COW: map parent's pages into child's pgtbl
+        flags &= ~PTE_W;
+        flags |= PTE_COW;
+        *pte = PA2PTE(pa) | flags;
       }
+      *npte = PA2PTE(pa) | flags;
       krefinc(pa);
     }
   }
-  // printf("New one:\n");
-  // vmprint(new);
-  return 0;
+out:
+  if(!share)
+    uvmflush(old, start, (PGROUNDUP(end) - start) / PGSIZE);  // now read-only
+  return r;
+}
 
- err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
-  return -1;
+// Given a parent process's page table, copy
+// its memory into a child's page table.
+// Copies the page table, and shares the
+// physical memory copy-on-write.
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  if(uvmcopyrange(old, new, 0, sz, 0) < 0) {
+    uvmunmap(new, 0, PGROUNDUP(sz) / PGSIZE, 1);
+    return -1;
+  }
+  return 0;
 }
 
 // mark a PTE invalid for user access.
@@ -499,6 +775,362 @@ uvmclear(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  uvmflush(pagetable, va, 1);
+}
+
+// Map the zero page at va, read-only, and copy-on-write if
+// perm allows stores.
+static int
+mapzeropage(pagetable_t pagetable, uint64 va, int perm)
+{
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, perm) != 0)
+    return -1;
+  krefinc((uint64)zeropage);
+  return 0;
+}
+
+// Map a new zeroed page at va.
+static int
+mapnewpage(pagetable_t pagetable, uint64 va, int perm)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in page va of p's heap, which growproc grows without
+// allocating. A load maps the zero page; a store, or breaking
+// copy-on-write of the zero page, uses up one of the pages
+// that growproc promised with kcommit.
+static int
+heapfault(struct proc *p, uint64 scause, uint64 va)
+{
+  pte_t *pte;
+  int zero = 1;
+
+  if(va >= p->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)) {
+    // only a store to a copy-on-write page can fault here;
+    // the stack guard page has no PTE_U.
+    if(scause != 15 || (*pte & (PTE_U|PTE_COW)) != (PTE_U|PTE_COW))
+      return -1;
+    zero = PTE2PA(*pte) == (uint64)zeropage;
+    if(cowcopypage(p->pagetable, va) < 0)
+      return -1;
+  } else if(scause != 15) {
+    return mapzeropage(p->pagetable, va, PTE_W|PTE_X|PTE_R|PTE_U);
+  } else if(mapnewpage(p->pagetable, va, PTE_W|PTE_X|PTE_R|PTE_U) < 0) {
+    return -1;
+  }
+  if(zero) {
+    p->nlazy--;
+    kuncommit(1);
+  }
+  return 0;
+}
+
+// Fault in page va of p's program, which exec leaves to be read
+// in on first touch. A page wholly in a segment's file part, at
+// a page-aligned file offset, maps the page cache, so processes
+// running the same program share it, copy-on-write if the
+// segment is writable; the file cannot be written while any
+// process runs it (see iexec). Other pages get a page of their own,
+// zero-filled past the file part. Returns -1 if va is not in
+// the program, 0 if the access can be retried, or -2.
+static int
+execfault(struct proc *p, uint64 scause, uint64 va)
+{
+  struct execseg *seg;
+  struct inode *ip = p->execip;
+  pte_t *pte;
+  char *mem;
+  uint64 off, n;
+  int perm;
+
+  if(va >= p->execend)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)) {
+    if(scause != 15 || (*pte & (PTE_U|PTE_COW)) != (PTE_U|PTE_COW))
+      return -2;
+    return cowcopypage(p->pagetable, va) == 0 ? 0 : -2;
+  }
+  for(seg = p->seg; seg < &p->seg[p->nseg]; seg++)
+    if(va >= seg->va && va < seg->end)
+      break;
+  if(seg == &p->seg[p->nseg])
+    return -2;
+  perm = seg->perm | PTE_U;
+
+  // bss only: like the heap, but nothing was promised for it.
+  if(va >= seg->fileend) {
+    if(scause != 15)
+      return mapzeropage(p->pagetable, va, perm) == 0 ? 0 : -2;
+    return mapnewpage(p->pagetable, va, perm) == 0 ? 0 : -2;
+  }
+
+  off = seg->off + (va - seg->va);
+  ilock(ip);
+  if(va + PGSIZE <= seg->fileend && off % PGSIZE == 0 &&
+     (scause != 15 || !(perm & PTE_W)) &&
+     mapcached(p->pagetable, va, ip, off / PGSIZE,
+               perm & PTE_W ? (perm & ~PTE_W) | PTE_COW : perm, 1) == 0) {
+    iunlock(ip);
+    return 0;
+  }
+  n = seg->fileend - va < PGSIZE ? seg->fileend - va : PGSIZE;
+  if((mem = kalloc()) == 0)
+    goto bad;
+  memset(mem, 0, PGSIZE);
+  if(readi(ip, 0, (uint64)mem, off, n) != n ||
+     mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0) {
+    kfree(mem);
+    goto bad;
+  }
+  iunlock(ip);
+  return 0;
+
+ bad:
+  iunlock(ip);
+  return -2;
+}
+
+// Fault in the pages of p's program in [va, va+len) that are
+// not there yet, or are copy-on-write if write is set. Called
+// before a copyin or copyout that may run with locks held, which
+// cannot read the program file itself (see kfault). Failures are
+// left for the copy to report.
+void
+uvmprefault(struct proc *p, uint64 va, uint64 len, int write)
+{
+  uint64 a, end;
+  pte_t *pte;
+
+  end = va + len;
+  if(end < va || end > p->execend)
+    end = p->execend;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte && (*pte & PTE_V) && (!write || !(*pte & PTE_COW)))
+      continue;
+    if(execfault(p, write ? 15 : 13, a) != 0)
+      break;
+  }
+}
+
+// Handle page fault scause (12, 13 or 15) at va in p, from
+// usertrap. Returns 0 if the access can be retried, or -1 if
+// p should be killed.
+int
+uvmfault(struct proc *p, uint64 scause, uint64 va)
+{
+  int r;
+
+  if(va >= MAXVA)
+    return -1;
+  if((r = handle_mmap(p, scause, va)) == -1 &&
+     (r = execfault(p, scause, va)) == -1)
+    r = heapfault(p, scause, va);
+  if(r != 0)
+    return -1;
+  // the TLB may hold the invalid PTE that faulted, and the
+  // way back to user space need not flush it (see tlbflush).
+  tlbflush(p, PGROUNDDOWN(va), 1);
+  return 0;
+}
+
+// Fault in page va for copyin (write == 0) or copyout, if
+// pagetable is the current process's. They may be called with
+// locks held (piperead holds pi->lock), so only the heap and
+// anonymous regions, which need no I/O, are always faulted in;
+// file mappings must have been touched from user space first,
+// and the program only when this process holds no lock at all:
+// execfault locks the program file, and doing that under some
+// other inode's lock would take the two in no fixed order. read
+// and write use uvmprefault for the rest.
+static int
+kfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma_region *vma;
+  uint64 scause = write ? 15 : 13;
+  int anon;
+
+  if(p == 0 || p->pagetable != pagetable || va >= MAXVA)
+    return -1;
+  if((vma = vma_lookup(p, va)) != 0) {
+    anon = vma->f == 0;
+    release(&p->vmalock);
+    if(!anon)
+      return -1;
+    return handle_mmap(p, scause, va) == 0 ? 0 : -1;
+  }
+  if(va < p->execend) {
+    if(mycpu()->noff > 0 || p->nsleep > 0)
+      return -1;
+    return execfault(p, scause, va) == 0 ? 0 : -1;
+  }
+  return heapfault(p, scause, va);
+}
+
+// Exchange the page mapped at user address va for the page *pa,
+// if the process alone has it and may write it, setting *pa to
+// the page that was mapped: pipes move whole pages to readers
+// this way instead of copying them. Returns 0, or -1.
+int
+uvmswappage(pagetable_t pagetable, uint64 va, char **pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return -1;
+  old = PTE2PA(*pte);
+  if(kref(old) != 1)
+    return -1;
+  *pte = PA2PTE(*pa) | PTE_FLAGS(*pte);
+  uvmflush(pagetable, va, 1);
+  *pa = (char*)old;
+  return 0;
+}
+
+// Unmap and return the page at user address va of p, if it is in
+// an anonymous region, writable and p's alone; for vmsplice. va
+// faults in as zeros again. Returns 0 if it can't be taken.
+char*
+uvmtakepage(struct proc *p, uint64 va)
+{
+  struct vma_region *vma;
+  pte_t *pte;
+  uint64 pa;
+  int anon;
+
+  if((vma = vma_lookup(p, va)) == 0)
+    return 0;
+  anon = vma->f == 0;
+  release(&p->vmalock);
+  if(!anon || (pte = walk(p->pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return 0;
+  pa = PTE2PA(*pte);
+  if(kref(pa) != 1)
+    return 0;
+  *pte = 0;
+  uvmflush(p->pagetable, va, 1);
+  return (char*)pa;
+}
+
+// Forget the translations cached for copyin and copyout, if
+// pagetable is the current process's. syscall starts each call
+// with an empty cache.
+void
+utlbflush(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p != 0 && p->pagetable == pagetable)
+    memset(p->utlb, 0, sizeof(p->utlb));
+}
+
+// Flush p's translations of npages pages from va out of the TLB,
+// a page at a time if there are few. That is needed only if p's
+// ASID tags them, or with KVMSHARE: otherwise the switch back to
+// the user page table flushes everything anyway. The other harts
+// p has run on flush its ASID before they run it again (see
+// uvmsatp); p runs on one hart at a time, and only p changes its
+// page table, so they need not be interrupted to do it now.
+static void
+tlbflush(struct proc *p, uint64 va, uint64 npages)
+{
+  uint64 asid = p->asid & ASIDMASK;
+  uint bit;
+
+#ifndef KVMSHARE
+  if(asid == 0)
+    return;
+#endif
+  if(npages > TLBFLUSHPAGES){
+    sfence_vma_asid(asid);
+  } else {
+    for(; npages > 0; npages--, va += PGSIZE)
+      sfence_vma_page(va, asid);
+  }
+  push_off();
+  bit = 1 << cpuid();
+  p->tlbstale |= p->tlbharts & ~bit;
+  pop_off();
+}
+
+// The PTEs of npages pages from va in pagetable changed, or went
+// away: if pagetable is the current process's, flush their
+// translations, from p->utlb and from the TLB. Adding a mapping
+// where there was none needs not, but for the page that faulted.
+void
+uvmflush(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+  uint64 end = va + npages*PGSIZE;
+  int i;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  for(i = 0; i < NUTLB; i++)
+    if(p->utlb[i].va >= va && p->utlb[i].va < end)
+      p->utlb[i].flags = 0;
+  tlbflush(p, va, npages);
+}
+
+// Translate the user page at va0 for a copy, faulting it in if
+// needed. The page must be user-accessible, and writable (not
+// copy-on-write) if write is set. Translations of p's own page
+// table are kept in p->utlb, so copying a large buffer, or many
+// small ones in one system call, walks each page table once.
+// Returns the physical address, or 0.
+static uint64
+uvmtranslate(struct proc *p, pagetable_t pagetable, uint64 va0, int write)
+{
+  struct utlb *e = 0;
+  uint64 need = write ? PTE_U|PTE_W : PTE_U;
+  pte_t *pte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  if(p != 0 && p->pagetable == pagetable) {
+    e = &p->utlb[(va0 >> PGSHIFT) % NUTLB];
+    if(e->va == va0 && (e->flags & need) == need)
+      return e->pa;
+  }
+
+  pte = walk(pagetable, va0, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW))) {
+    // not faulted in yet, or copy-on-write.
+    if(kfault(pagetable, va0, write) < 0)
+      return 0;
+    tlbflush(p, va0, 1);  // as in uvmfault
+    pte = walk(pagetable, va0, 0);
+  }
+  if(pte == 0 || (*pte & (PTE_V|need)) != (PTE_V|need))
+    return 0;
+  if(e) {
+    e->va = va0;
+    e->pa = PTE2PA(*pte);
+    e->flags = PTE_FLAGS(*pte);
+  }
+  return PTE2PA(*pte);
 }
 
 // Copy from kernel to user.
@@ -507,52 +1139,17 @@ uvmclear(pagetable_t pagetable, uint64 va)
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
+  struct proc *p = myproc();
   uint64 n, va0, pa0;
-  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA) {
-      return -1;
-    }
-    if((pte = walk(pagetable, va0, 0)) == 0) {
+    if((pa0 = uvmtranslate(p, pagetable, va0, 1)) == 0)
       return -1;
-    }
-
-    pa0 = PTE2PA(*pte);
-    if(pa0 == 0) {
-      return -1;
-    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
 
-    if(*pte & PTE_COW) {
-      uint flags = PTE_FLAGS(*pte);
-      if(kref(pa0) > 1) {
-        // COW page
-        krefacquire();
-        if(kref(pa0) > 1) {
-          // copy page
-          void *new_pa = kalloc();
-          if(new_pa == 0) {
-            krefrelease();
-            return -1;
-          }
-          if(n < PGSIZE) {
-            // need to copy original data first
-            memmove(new_pa, (const void *)pa0, PGSIZE);
-          }
-          krefdec(pa0);
-          pa0 = (uint64)new_pa;
-        }
-        krefrelease();
-      }
-      flags |= PTE_W;
-      flags &= ~PTE_COW;
-      *pte = PA2PTE((uint64)pa0) | flags;
-    }
-
     memmove((void *)(pa0 + (dstva - va0)), src, n);
 
     len -= n;
@@ -568,12 +1165,12 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
+  struct proc *p = myproc();
   uint64 n, va0, pa0;
   
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmtranslate(p, pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -594,178 +1191,602 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
+  struct proc *p = myproc();
+  uint64 n, len, va0, pa0;
+  char *s;
 
-  while(got_null == 0 && max > 0){
+  while(max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmtranslate(p, pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
+    // find the end a word at a time, then copy up to it.
+    s = (char *) (pa0 + (srcva - va0));
+    len = strnlen(s, n);
+    memmove(dst, s, len);
+    if(len < n){
+      dst[len] = '\0';
+      return 0;
     }
 
+    dst += n;
+    max -= n;
     srcva = va0 + PGSIZE;
   }
-  if(got_null){
-    return 0;
-  } else {
-    return -1;
-  }
+  return -1;
 }
 
-// lookup for vma_region in vma region list
-// return vma_region with lock held
+// lookup for vma_region in p's sorted vma array,
+// trying the region last looked up first.
+// return vma_region with p->vmalock held
 // or NULL if not found
 struct vma_region *
 vma_lookup(struct proc *p, uint64 addr)
 {
-  struct vma_region *vma = p->vma;
-  while(vma) {
-    acquire(&vma->lock);
-    if(addr >= vma->addr && addr <= vma->addr + vma->length) {
-      break;
-    }
-    release(&vma->lock);
-    vma = vma->next;
+  struct vma_region *vma;
+  int i;
+
+  acquire(&p->vmalock);
+  if(p->vmahint < p->nvma) {
+    vma = &p->vma[p->vmahint];
+    if(addr >= vma->addr && addr < VMA_END(vma))
+      return vma;
+  }
+  i = vma_search(p, addr);
+  if(i < p->nvma && addr >= p->vma[i].addr) {
+    p->vmahint = i;
+    return &p->vma[i];
   }
-  return vma;
+  release(&p->vmalock);
+  return 0;
 }
 
-int
-munmap(struct proc *p, const uint64 addr, const int length)
+// Write [va, va+n) of MAP_SHARED vma back to its file, with one
+// writei per log transaction. Returns 0, or -1 if a writei
+// came up short.
+static int
+vma_writeback(struct vma_region *vma, uint64 va, uint64 n)
 {
-  struct vma_region *vma = 0;
   // borrowed from filewrite
   const int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip = vma->f->ip;
+  uint64 m;
+  int r;
+
+  for(; n > 0; va += m, n -= m) {
+    m = n < max ? n : max;
+    begin_op();
+    ilock(ip);
+    r = writei(ip, 1, va, va - vma->addr + vma->offset, m);
+    iunlock(ip);
+    end_op();
+    if(r != m)
+      return -1;
+  }
+  return 0;
+}
 
-  // walk through the range
-  int left = max; // batching optimization
-
-  // the locking here is a bit obscure
-  // because we can't hold a lock while doing I/O
-  // for convenience vma_region locks are only held when they're removed
-  // this means concurrent munmap calls might be dangerous
-  begin_op();
-  for(uint64 va = addr; va < addr + length; va += PGSIZE) {
-    if(!vma || va < vma->addr || va > vma->addr + vma->length) {
-      // wrong region, find another one
-      if(vma) {
-        // should we release last one?
-        acquire(&vma->lock);
-        if(addr <= vma->addr && addr + length >= vma->addr + vma->length) {
-          vma_remove(p, vma);
-        } else {
-          release(&vma->lock);
-        }
-      }
-      vma = vma_lookup(p, addr);
-      if(!vma) {
-        printf("munmap: addr %p not found\n", addr);
-        return -1;
+// Write back the run [start, end) of vma's dirty pages, whose
+// PTE_D vma_sync has cleared. If that fails, mark them dirty
+// again, so that they are not taken for clean. Returns 0, or -1.
+static int
+vma_syncrun(struct proc *p, struct vma_region *vma, uint64 start, uint64 end)
+{
+  uint64 fend = vma->addr + vma->length;  // no more of the file is mapped
+  pte_t *pte;
+
+  if(vma_writeback(vma, start, (end < fend ? end : fend) - start) == 0)
+    return 0;
+  for(; start < end; start += PGSIZE)
+    if((pte = walk(p->pagetable, start, 0)) != 0 && (*pte & PTE_V))
+      *pte |= PTE_D;
+  return -1;
+}
+
+// Write the dirty pages of vma in [start, end) back to its
+// file if it is MAP_SHARED, and mark them clean. Walks the page
+// table a last-level page at a time, skipping holes in the upper
+// levels, and writes back each run of contiguous dirty pages at
+// once. Stops after max dirty pages; returns the address it got
+// to. Sets *failed if a writeback failed, leaving its pages
+// dirty.
+static uint64
+vma_sync(struct proc *p, struct vma_region *vma, uint64 start, uint64 end,
+         int max, int *failed)
+{
+  pagetable_t l0;
+  pte_t *pte;
+  uint64 va, next, rstart = 0, rend = 0;
+  int n = 0;
+
+  if(!(vma->flags & MAP_SHARED) || vma->f == 0)
+    return end;
+
+  va = start;
+  while(va < end && n < max) {
+    if((l0 = walkl0(p->pagetable, va, end, &next)) == 0) {
+      va = next;
+      continue;
+    }
+    for(; va < next && n < max; va += PGSIZE) {
+      pte = &l0[PX(0, va)];
+      if((*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+        continue;
+      if(va != rend) {
+        // not contiguous with the current run; flush it.
+        if(rend > rstart && vma_syncrun(p, vma, rstart, rend) < 0)
+          *failed = 1;
+        rstart = va;
       }
-      release(&vma->lock);
-      // start a new fs operation
-      end_op();
-      left = max;
-      begin_op();
+      // p is in the kernel, so nothing can store to the page
+      // between here and the writeback.
+      *pte &= ~PTE_D;
+      rend = va + PGSIZE;
+      n++;
     }
-    pte_t *pte = walk(p->pagetable, va, 0);
-    if(!pte || (*pte & PTE_V) == 0) {
-      // not mapped, nothing to do
+  }
+  if(rend > rstart && vma_syncrun(p, vma, rstart, rend) < 0)
+    *failed = 1;
+  if(n > 0)  // so that the next store sets PTE_D again
+    uvmflush(p->pagetable, start, (va - start) / PGSIZE);
+  return va;
+}
+
+// Unmap the pages of vma in [start, end), first writing back
+// the dirty ones if it is MAP_SHARED. The pages go even if that
+// fails; their data stays in the page cache.
+static void
+vma_unmap(struct proc *p, struct vma_region *vma, uint64 start, uint64 end)
+{
+  pagetable_t l0;
+  pte_t *pte;
+  uint64 va, next;
+  int failed = 0;
+
+  vma_sync(p, vma, start, end, (end - start) / PGSIZE, &failed);
+
+  for(va = start; va < end; va = next) {
+    if((l0 = walkl0(p->pagetable, va, end, &next)) == 0)
       continue;
+    for(; va < next; va += PGSIZE) {
+      pte = &l0[PX(0, va)];
+      if((*pte & PTE_V) == 0)
+        continue;
+      if(PTE_FLAGS(*pte) == PTE_V)
+        panic("vma_unmap: not a leaf");
+      putpage(PTE2PA(*pte));
+      *pte = 0;
     }
-    if(vma->flags & MAP_SHARED && (*pte & PTE_D)) {
-      // dirty, write back
-      int len = PGSIZE;
-      if(va + len > vma->addr + vma->length) {
-        len = vma->addr + vma->length - addr;
-      }
-      if(len > left) {
-        // start a new fs operation
-        end_op();
-        left = max;
-        begin_op();
-      }
-      ilock(vma->f->ip);
-      writei(vma->f->ip, 1, va, va - vma->addr + vma->offset, len);
-      iunlock(vma->f->ip);
-      left -= len;
+  }
+  uvmflush(p->pagetable, start, (end - start) / PGSIZE);
+}
+
+// PTE permissions for the pages of vma.
+static int
+vmaperm(struct vma_region *vma)
+{
+  int perm = PTE_U;
+
+  if(vma->prot & PROT_READ)
+    perm |= PTE_R;
+  if(vma->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(vma->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Copy the pages of p's anonymous region vma into np's page
+// table for fork: copy-on-write if the region is private, the
+// same pages if it is MAP_SHARED. A shared region's untouched
+// pages get pages of their own in p first, or p and np would
+// each fault in a different one later. File-backed regions are
+// left for np to fault in again.
+int
+vma_copy(struct proc *p, struct proc *np, struct vma_region *vma)
+{
+  int perm = vmaperm(vma);
+  pte_t *pte;
+  uint64 va;
+
+  if((vma->flags & MAP_SHARED) && (perm & (PTE_R|PTE_W|PTE_X))) {
+    for(va = vma->addr; va < VMA_END(vma); va += PGSIZE) {
+      if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+        continue;
+      if(mapnewpage(p->pagetable, va, perm) < 0)
+        return -1;
     }
-    // unmap this page
-    uvmunmap(p->pagetable, va, 1, 1);
   }
-  end_op();
+  return uvmcopyrange(p->pagetable, np->pagetable, vma->addr, VMA_END(vma),
+                      vma->flags & MAP_SHARED);
+}
+
+int
+munmap(struct proc *p, const uint64 addr, const int length)
+{
+  struct vma_region *vma, *rest;
+  uint64 va, start, end, vend;
+  int i, found = 0;
+
+  if(length <= 0)
+    return -1;
 
-  // should we release the last one?
-  if(vma){
-    acquire(&vma->lock);
-    if(addr <= vma->addr && addr + length >= vma->addr + vma->length) {
+  // a hole in the middle of a region splits it in two, which
+  // needs a free slot. check before anything is unmapped, so
+  // that failing leaves everything as it was.
+  acquire(&p->vmalock);
+  i = vma_search(p, addr);
+  if(p->nvma == VMA_REGION_COUNT && i < p->nvma && p->vma[i].addr < addr &&
+     PGROUNDUP(addr + length) < VMA_END(&p->vma[i])) {
+    release(&p->vmalock);
+    return -1;
+  }
+  release(&p->vmalock);
+
+  // one region at a time, in address order. only this process
+  // changes its regions, so vma stays put while the lock is
+  // dropped for I/O.
+  for(va = addr; va < addr + length; va = end) {
+    acquire(&p->vmalock);
+    i = vma_search(p, va);
+    if(i == p->nvma || p->vma[i].addr >= addr + length) {
+      release(&p->vmalock);
+      break;
+    }
+    vma = &p->vma[i];
+    vend = VMA_END(vma);
+    start = va > vma->addr ? va : vma->addr;
+    end = PGROUNDUP(addr + length) < vend ? PGROUNDUP(addr + length) : vend;
+    release(&p->vmalock);
+    found = 1;
+
+    vma_unmap(p, vma, start, end);
+
+    // drop [start, end) from the region
+    acquire(&p->vmalock);
+    if(start == vma->addr && end == vend) {
       vma_remove(p, vma);
+      continue;
+    }
+    if(start == vma->addr) {
+      vma->offset += end - start;
+      vma->length -= end - start;
+      vma->addr = end;
+    } else if(end == vend) {
+      vma->length = start - vma->addr;
     } else {
-      release(&vma->lock);
+      // a hole in the middle: split the region in two.
+      // there is room, checked above.
+      i = vma - p->vma;
+      memmove(vma + 2, vma + 1, (p->nvma - i - 1) * sizeof(*vma));
+      p->nvma++;
+      rest = vma + 1;
+      *rest = *vma;
+      rest->addr = end;
+      rest->offset += end - vma->addr;
+      rest->length -= end - vma->addr;
+      rest->ranext = end;
+      if(rest->f)
+        filedup(rest->f);
+      vma->length = start - vma->addr;
     }
+    release(&p->vmalock);
+  }
+
+  if(!found) {
+    printf("munmap: addr %p not found\n", addr);
+    return -1;
   }
-  
   return 0;
 }
 
+// Write back the dirty pages of the MAP_SHARED regions in
+// [addr, addr+length). MS_ASYNC only checks the range: the
+// background writeback in vma_wbtick gets to it soon enough.
+// MS_INVALIDATE has nothing to do, as MAP_SHARED regions map
+// the page cache itself. Returns -1 if nothing in the range is
+// mapped or a page could not be written back.
+int
+msync(struct proc *p, uint64 addr, int length, int flags)
+{
+  struct vma_region *vma;
+  uint64 va, start, end;
+  int i, found = 0, failed = 0;
+
+  if(length < 0 || addr % PGSIZE != 0 ||
+     (flags & ~(MS_ASYNC|MS_SYNC|MS_INVALIDATE)) != 0 ||
+     (flags & (MS_ASYNC|MS_SYNC)) == (MS_ASYNC|MS_SYNC))
+    return -1;
+
+  // one region at a time, as in munmap.
+  for(va = addr; va < addr + length; va = end) {
+    acquire(&p->vmalock);
+    i = vma_search(p, va);
+    if(i == p->nvma || p->vma[i].addr >= addr + length) {
+      release(&p->vmalock);
+      break;
+    }
+    vma = &p->vma[i];
+    start = va > vma->addr ? va : vma->addr;
+    end = PGROUNDUP(addr + length) < VMA_END(vma) ?
+          PGROUNDUP(addr + length) : VMA_END(vma);
+    release(&p->vmalock);
+    found = 1;
+
+    if(!(flags & MS_ASYNC))
+      vma_sync(p, vma, start, end, (end - start) / PGSIZE, &failed);
+  }
+  return found && !failed ? 0 : -1;
+}
+
+// Called on each timer interrupt from user space. Every
+// WBINTERVAL ticks, go on writing back p's MAP_SHARED regions
+// from where the last pass stopped, up to WBBATCH dirty pages
+// of each, so that the writeback of a long-lived mapping is
+// spread out rather than all left to munmap.
+void
+vma_wbtick(struct proc *p)
+{
+  struct vma_region *vma;
+  uint64 start, end;
+  int i, n, failed = 0;
+
+  if(ticks - p->wbtick < WBINTERVAL)
+    return;
+  p->wbtick = ticks;
+
+  for(n = 0; n < p->nvma; n++) {
+    acquire(&p->vmalock);
+    if(p->nvma == 0) {
+      release(&p->vmalock);
+      return;
+    }
+    if((i = vma_search(p, p->wbnext)) == p->nvma) {
+      // past the last region; start over.
+      i = 0;
+      p->wbnext = 0;
+    }
+    vma = &p->vma[i];
+    start = p->wbnext > vma->addr ? p->wbnext : vma->addr;
+    end = VMA_END(vma);
+    release(&p->vmalock);
+
+    if((vma->flags & MAP_SHARED) && vma->f) {
+      // a failed writeback leaves its pages for msync to report.
+      p->wbnext = vma_sync(p, vma, start, end, WBBATCH, &failed);
+      if(p->wbnext < end)
+        return;  // used up this pass's batch
+    } else {
+      p->wbnext = end;
+    }
+  }
+}
+
+// Is any of [addr, addr+len) in one of p's regions?
+// Caller must hold p->vmalock.
+static int
+vma_overlap(struct proc *p, uint64 addr, uint64 len)
+{
+  int i = vma_search(p, addr);
+
+  return i < p->nvma && p->vma[i].addr < addr + len;
+}
+
+// Lowest address from VMA_ADDR_START up with room for len
+// bytes between p's regions, or 0.
+// Caller must hold p->vmalock.
+static uint64
+vma_gap(struct proc *p, uint64 len)
+{
+  uint64 a = VMA_ADDR_START;
+
+  for(int i = vma_search(p, a); i < p->nvma; i++) {
+    if(a + len <= p->vma[i].addr)
+      break;
+    a = VMA_END(&p->vma[i]);
+  }
+  if(a + len > VMA_ADDR_END)
+    return 0;
+  return a;
+}
+
 uint64
 mmap(struct proc *p, uint64 addr, int length,
       int prot, int flags, struct file *f, int offset)
 {
-  // first, get a new vma region
-  struct vma_region *vma = vma_alloc();
-  if(vma == 0) {
+  struct vma_region *vma;
+  uint64 len = PGROUNDUP((uint64)length);
+
+  if(length <= 0) {
+    return -1;
+  }
+  if((f == 0) != ((flags & MAP_ANONYMOUS) != 0)) {
+    return -1;
+  }
+  if(f && (flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable) {
     return -1;
   }
 
-  if(addr == 0) {
-    // default address is either VMA_ADDR_START or after last vma_region
-    addr = VMA_ADDR_START;
-    if(p->vma) {
-      addr = PGROUNDUP(p->vma->addr + p->vma->length);
-    }
-  } else {
-    // pick a nearby page boundary
-    // this behavior is same as linux
-    addr = PGROUNDUP(addr);
+  acquire(&p->vmalock);
+  // use addr as a hint, rounded to a nearby page boundary as
+  // linux does, if it doesn't collide with the heap or another
+  // region. otherwise take the lowest gap that fits.
+  addr = PGROUNDUP(addr);
+  if(addr < PGROUNDUP(p->sz) || addr + len > VMA_ADDR_END ||
+     (addr < VMA_ADDR_START && addr + len > HEAPTOP) ||
+     vma_overlap(p, addr, len)) {
+    addr = vma_gap(p, len);
   }
-  
-  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable) {
-    goto bad;
+  if(addr == 0 || (vma = vma_insert(p, addr)) == 0) {
+    release(&p->vmalock);
+    return -1;
   }
 
-  vma->addr = addr;
   vma->length = length;
   vma->prot = prot;
   vma->flags = flags;
-  vma->f = filedup(f);
+  vma->f = f ? filedup(f) : 0;
   vma->offset = offset;
+  vma->advice = MADV_NORMAL;
+  vma->ranext = addr;
 
-  vma_add(p, vma);
+  release(&p->vmalock);
+  return addr;
+}
 
-  release(&vma->lock);
-  return vma->addr;
-bad:
-  release(&vma->lock);
-  return -1;
+// Page number within the file of address va in vma.
+#define VMAPGNO(vma, va) (((vma)->offset + (va) - (vma)->addr) / PGSIZE)
+
+// Map page va from the page cache, where it is page pgno of ip,
+// taking a reference to the physical page for the mapping. Reads
+// the page in if fill is set; otherwise only maps it if cached.
+// Caller must hold ip->lock. Returns 0, or -1 if not mapped.
+static int
+mapcached(pagetable_t pagetable, uint64 va, struct inode *ip, uint pgno,
+          int perm, int fill)
+{
+  struct cpage *pg;
+
+  if(fill)
+    pg = igetpage(ip, pgno);
+  else
+    pg = pcache_lookup(ip->dev, ip->inum, pgno);
+  if(pg == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)pg->pa, perm) < 0) {
+    pcache_put(pg);
+    return -1;
+  }
+  krefinc((uint64)pg->pa);
+  pcache_put(pg);
+  return 0;
+}
+
+// End of the part of vma backed by ip, rounded up to a page.
+static uint64
+vmaend(struct vma_region *vma, struct inode *ip)
+{
+  uint64 end = PGROUNDUP(vma->addr + vma->length);
+  uint64 fend = vma->addr + PGROUNDUP(ip->size) - vma->offset;
+
+  if(ip->size <= vma->offset)
+    return vma->addr;
+  return fend < end ? fend : end;
+}
+
+// Read the pages of [start, end) in vma into the page cache,
+// stopping early if it fills up.
+// Caller must hold ip->lock.
+static void
+readahead(struct vma_region *vma, struct inode *ip, uint64 start, uint64 end)
+{
+  struct cpage *pg;
+
+  for(uint64 a = start; a < end; a += PGSIZE) {
+    if((pg = igetpage(ip, VMAPGNO(vma, a))) == 0)
+      break;
+    pcache_put(pg);
+  }
+}
+
+// After a fault at va in a vma that maps the page cache, map
+// the other cached pages of the FAULTAROUND-page window around
+// va as well, so that touching them won't fault. If the faults
+// look like a sequential scan, first read the rest of this
+// window and the next one into the page cache, so that the next
+// fault finds its whole window cached.
+// Caller must hold ip->lock.
+static void
+faultaround(struct proc *p, struct vma_region *vma, struct inode *ip,
+            uint64 va, int perm)
+{
+  uint64 start, end, a;
+  pte_t *pte;
+
+  if(vma->advice == MADV_RANDOM)
+    return;
+
+  start = va & ~((uint64)FAULTAROUND*PGSIZE - 1);
+  if(start < vma->addr)
+    start = vma->addr;
+  end = start + FAULTAROUND*PGSIZE;
+  if(end > vmaend(vma, ip))
+    end = vmaend(vma, ip);
+
+  if(vma->advice == MADV_SEQUENTIAL || va == vma->ranext) {
+    a = end + FAULTAROUND*PGSIZE;
+    readahead(vma, ip, va + PGSIZE, a < vmaend(vma, ip) ? a : vmaend(vma, ip));
+    vma->ranext = end;
+  }
+
+  for(a = start; a < end; a += PGSIZE) {
+    if(a == va)
+      continue;
+    if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+      continue;
+    mapcached(p->pagetable, a, ip, VMAPGNO(vma, a), perm, 0);
+  }
+}
+
+int
+madvise(struct proc *p, uint64 addr, int length, int advice)
+{
+  struct vma_region *vma;
+  struct inode *ip;
+  uint64 start, end;
+
+  if(advice < MADV_NORMAL || advice > MADV_WILLNEED)
+    return -1;
+  if((vma = vma_lookup(p, addr)) == 0)
+    return -1;
+  // only this process changes its vmas, so it is safe to use
+  // vma without the lock while reading the file below.
+  release(&p->vmalock);
+
+  if(advice != MADV_WILLNEED) {
+    vma->advice = advice;
+    return 0;
+  }
+  if(vma->f == 0)
+    return 0;
+
+  ip = vma->f->ip;
+  ilock(ip);
+  start = PGROUNDDOWN(addr);
+  end = PGROUNDUP(addr + length);
+  if(end > vmaend(vma, ip))
+    end = vmaend(vma, ip);
+  // leave most of the page cache to others.
+  if(end > start + NPCACHE/2*PGSIZE)
+    end = start + NPCACHE/2*PGSIZE;
+  if(ip->type == T_FILE)
+    readahead(vma, ip, start, end);
+  iunlock(ip);
+  return 0;
+}
+
+// Fault in page va of anonymous region vma. A load or fetch in
+// a private region maps the zero page copy-on-write; otherwise
+// the page gets a zeroed page of its own. Pages of a MAP_SHARED
+// region are never the zero page; fork maps every one of them,
+// so that parent and child share them all (see vma_copy).
+static int
+anonfault(struct proc *p, struct vma_region *vma, uint64 scause,
+          uint64 va, int perm)
+{
+  pte_t *pte;
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)) {
+    if(scause == 15 && (*pte & PTE_COW))
+      return cowcopypage(p->pagetable, va) == 0 ? 0 : -2;
+    return -2;
+  }
+  if(scause != 15 && !(vma->flags & MAP_SHARED))
+    return mapzeropage(p->pagetable, va, perm) == 0 ? 0 : -2;
+  return mapnewpage(p->pagetable, va, perm) == 0 ? 0 : -2;
 }
 
 int
@@ -779,7 +1800,7 @@ handle_mmap(struct proc *p, uint64 scause, uint64 addr)
   }
 
   // read & map a page
-  uint64 pte_perm = PTE_U;
+  uint64 pte_perm = vmaperm(vma);
   uint64 kpage;
   if((scause == 12 && !(vma->prot & PROT_EXEC)) ||
       (scause == 13 && !(vma->prot & PROT_READ)) ||
@@ -787,42 +1808,61 @@ handle_mmap(struct proc *p, uint64 scause, uint64 addr)
     printf("error handle_mmap: scause = %d, prot = %d\n", scause, vma->prot);
     goto bad;
   }
-  if(vma->f == 0) {
-    panic("handle_mmap: no file");
-    goto bad;
+  // only this process changes its vmas, so it is safe to use
+  // vma without the lock while reading the file below.
+  release(&p->vmalock);
+
+  uint64 va = PGROUNDDOWN(addr);
+  if(vma->f == 0)
+    return anonfault(p, vma, scause, va, pte_perm);
+
+  struct inode *ip = vma->f->ip;
+  int read_offset = vma->offset + va - vma->addr;
+  ilock(ip);
+  // map the page-cache page itself when stores to the mapping
+  // are to be shared, or there can be none. every process
+  // mapping this file, and read(), then see the same bytes.
+  if(((vma->flags & MAP_SHARED) || !(vma->prot & PROT_WRITE)) &&
+     ip->type == T_FILE && vma->offset % PGSIZE == 0 &&
+     mapcached(p->pagetable, va, ip, VMAPGNO(vma, va), pte_perm, 1) == 0) {
+    faultaround(p, vma, ip, va, pte_perm);
+    iunlock(ip);
+    return 0;
   }
-  // do mapping
-  kpage = (uint64)kalloc();
-  if(vma->prot & PROT_READ)
-    pte_perm |= PTE_R;
-  if(vma->prot & PROT_WRITE)
-    pte_perm |= PTE_W;
-  if(vma->prot & PROT_EXEC)
-    pte_perm |= PTE_X;
-  if(mappages(p->pagetable, PGROUNDDOWN(addr), PGSIZE, kpage, pte_perm) < 0) {
-    panic("handle_mmap: mappages");
-    goto bad;
+
+  // private copy, read (through the page cache) from the file.
+  // shared mappings that can't use the page cache also end up
+  // here, and are written back when unmapped.
+  if((kpage = (uint64)kalloc()) == 0) {
+    iunlock(ip);
+    return -2;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, kpage, pte_perm) < 0) {
+    kfree((void *)kpage);
+    iunlock(ip);
+    return -2;
   }
-  // read content
   // in user-space we're writing @ PGROUNDDOWN(addr)
   // in kernel-space we're writing @ kpage
-  struct inode *ip = vma->f->ip;
   uint64 addr_start = kpage;  // this is kernel pointer
-  int read_offset = vma->offset + PGROUNDDOWN(addr) - vma->addr;
   int left = PGSIZE;
-  ilock(ip);
-  for(int read_count; (read_count = readi(ip, 0, addr_start, read_offset, left)); ) {
+  for(int read_count; (read_count = readi(ip, 0, addr_start, read_offset, left)) > 0; ) {
     addr_start += read_count;
     read_offset += read_count;
     left -= read_count;
   }
+  if(vma->advice != MADV_RANDOM && va == vma->ranext && ip->type == T_FILE) {
+    // sequential: warm the page cache for the next faults.
+    uint64 end = va + FAULTAROUND*PGSIZE;
+    readahead(vma, ip, va + PGSIZE, end < vmaend(vma, ip) ? end : vmaend(vma, ip));
+    vma->ranext = va + PGSIZE;
+  }
   iunlock(ip);
   if(left) {
     memset((void *)addr_start, 0, left);
   }
-  release(&vma->lock);
   return 0;
 bad:
-  release(&vma->lock);
+  release(&p->vmalock);
   return -2;
 }
@@ -17,6 +17,8 @@
 
 #define NINODES 200
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
@@ -40,6 +42,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void bappend(struct dinode *din, uint off, char *p, int n);
+void writedir(uint inum, struct dirent *de, int n);
 void die(const char *);
 
 // convert to intel byte order
@@ -69,10 +73,10 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  struct dirent de[2+NINODES];
+  int nde;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -83,7 +87,9 @@ main(int argc, char *argv[])
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert(sizeof(((struct dinode*)0)->data) == NINLINE);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct dxroot) <= BSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
@@ -117,15 +123,12 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  bzero(de, sizeof(de));
+  de[0].inum = xshort(rootino);
+  strcpy(de[0].name, ".");
+  de[1].inum = xshort(rootino);
+  strcpy(de[1].name, "..");
+  nde = 2;
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -136,6 +139,7 @@ main(int argc, char *argv[])
       shortname = argv[i];
     
     assert(index(shortname, '/') == 0);
+    assert(nde < sizeof(de)/sizeof(de[0]));
 
     if((fd = open(argv[i], 0)) < 0)
       die(argv[i]);
@@ -149,10 +153,9 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    de[nde].inum = xshort(inum);
+    strncpy(de[nde].name, shortname, DIRSIZ);
+    nde++;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,18 +163,83 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  writedir(rootino, de, nde);
 
   balloc(freeblock);
 
   exit(0);
 }
 
+// Must match dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261U;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
+
+int
+dehashcmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the n entries at de as the contents of directory inum,
+// in the layout described in kernel/fs.h.
+void
+writedir(uint inum, struct dirent *de, int n)
+{
+  struct dxroot root;
+  struct dirent leaf[DPB];
+  struct dinode din;
+  int i, j, nleaf, start[DXMAXLEAF+1];
+
+  if(n <= DPB){
+    iappend(inum, de, n * sizeof(*de));
+    // a directory that is not inline occupies a whole block.
+    rinode(inum, &din);
+    if(xint(din.size) > NINLINE){
+      din.size = xint(BSIZE);
+      winode(inum, &din);
+    }
+    return;
+  }
+
+  // Fill leaves about 3/4 full, so the kernel can add entries
+  // without splitting right away, and never let a run of equal
+  // hashes straddle two leaves.
+  qsort(de, n, sizeof(*de), dehashcmp);
+  bzero(&root, sizeof(root));
+  nleaf = 0;
+  for(i = 0; i < n; i = j){
+    j = i + min(n - i, DPB*3/4);
+    while(j < n && j - i < DPB && dirhash(de[j].name) == dirhash(de[j-1].name))
+      j++;
+    assert(j == n || dirhash(de[j].name) != dirhash(de[j-1].name));
+    assert(nleaf < DXMAXLEAF);
+    start[nleaf] = i;
+    root.leaf[nleaf].hash = xint(nleaf == 0 ? 0 : dirhash(de[i].name));
+    root.leaf[nleaf].bn = xint(nleaf + 1);
+    nleaf++;
+  }
+  start[nleaf] = n;
+  root.nleaf = xint(nleaf);
+  iappend(inum, &root, sizeof(root));
+  iappend(inum, zeroes, BSIZE - sizeof(root));
+
+  for(i = 0; i < nleaf; i++){
+    bzero(leaf, sizeof(leaf));
+    memmove(leaf, de + start[i], (start[i+1] - start[i]) * sizeof(*de));
+    iappend(inum, leaf, sizeof(leaf));
+  }
+}
+
 void
 wsect(uint sec, void *buf)
 {
@@ -247,37 +315,60 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
 
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint off;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  char spill[NINLINE];
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  if(off + n <= NINLINE){
+    // still fits in the inode
+    memmove(din.data + off, p, n);
+  } else {
+    if(off <= NINLINE){
+      // move the inline content out to a data block first
+      memmove(spill, din.data, off);
+      memset(din.data, 0, sizeof(din.data));
+      bappend(&din, 0, spill, off);
+    }
+    bappend(&din, off, p, n);
+  }
+  din.size = xint(off + n);
+  winode(inum, &din);
+}
+
+// write n bytes at offset off of din's data blocks,
+// allocating blocks as needed. does not update din.size.
+void
+bappend(struct dinode *din, uint off, char *p, int n)
+{
+  uint fbn, n1;
+  char buf[BSIZE];
+  uint indirect[NINDIRECT];
+  uint x;
+
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
     if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
+      if(xint(din->addrs[fbn]) == 0){
+        din->addrs[fbn] = xint(freeblock++);
       }
-      x = xint(din.addrs[fbn]);
+      x = xint(din->addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      if(xint(din->addrs[NDIRECT]) == 0){
+        din->addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      rsect(xint(din->addrs[NDIRECT]), (char*)indirect);
       if(indirect[fbn - NDIRECT] == 0){
         indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+        wsect(xint(din->addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
     }
@@ -289,8 +380,6 @@ iappend(uint inum, void *xp, int n)
     off += n1;
     p += n1;
   }
-  din.size = xint(off);
-  winode(inum, &din);
 }
 
 void
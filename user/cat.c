@@ -9,6 +9,12 @@ cat(int fd)
 {
   int n;
 
+  // files and pipes go to the output inside the kernel.
+  while((n = sendfile(1, fd, -1, 8192)) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
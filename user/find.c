@@ -37,9 +37,9 @@ dir_pop(char *dir)
 void
 find(char *dir, const char *name, int sz)
 {
-    int fd;
+    int fd, i, n;
     struct stat st;
-    struct dirent de;
+    struct direntplus de[8];
 
     // printf("Finding %s\n", dir);
 
@@ -61,20 +61,25 @@ find(char *dir, const char *name, int sz)
         }
         break;
     case T_DIR:
-        while(read(fd, &de, sizeof(de)) == sizeof(de)) {
-            if(de.inum == 0) {
-                continue;
+        // getdents hands back each entry's type, so only
+        // subdirectories need to be opened.
+        while((n = getdents(fd, de, sizeof(de) / sizeof(de[0]))) > 0) {
+            for(i = 0; i < n; i++) {
+                if(strcmp(de[i].name, ".") == 0 || strcmp(de[i].name, "..") == 0) {
+                    continue;
+                }
+                dir = dir_push(dir, de[i].name, sz);
+                if(!dir) {
+                    fprintf(2, "find: path too long\n");
+                    exit(-1);
+                }
+                if(de[i].type == T_DIR) {
+                    find(dir, name, sz);
+                } else if(strcmp(de[i].name, name) == 0) {
+                    printf("%s\n", dir);
+                }
+                dir_pop(dir);
             }
-            if(strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0) {
-                continue;
-            }
-            dir = dir_push(dir, de.name, sz);
-            if(!dir) {
-                fprintf(2, "find: path too long\n");
-                exit(-1);
-            }
-            find(dir, name, sz);
-            dir_pop(dir);
         }
         break;
     }
@@ -8,6 +8,12 @@
 
 void mmap_test();
 void fork_test();
+void shared_test();
+void scan_test();
+void regions_test();
+void sparse_test();
+void anon_test();
+void msync_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *) -1)
@@ -17,6 +23,12 @@ main(int argc, char *argv[])
 {
   mmap_test();
   fork_test();
+  shared_test();
+  scan_test();
+  regions_test();
+  sparse_test();
+  anon_test();
+  msync_test();
   printf("mmaptest: all tests succeeded\n");
   exit(0);
 }
@@ -295,3 +307,303 @@ fork_test(void)
   printf("fork_test OK\n");
 }
 
+//
+// map a file MAP_SHARED twice, and check that a store through
+// one mapping shows up in the other, and in read(), right away,
+// since both map the file's page in the page cache.
+//
+void
+shared_test(void)
+{
+  int fd, pid;
+  const char * const f = "mmap.dur";
+
+  printf("shared_test starting\n");
+  testname = "shared_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  char *p1 = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p1 == MAP_FAILED)
+    err("mmap (6)");
+  char *p2 = mmap(0, PGSIZE*2, PROT_READ, MAP_SHARED, fd, 0);
+  if (p2 == MAP_FAILED)
+    err("mmap (7)");
+  _v1(p2);
+
+  p1[10] = 'B';
+  if (p2[10] != 'B')
+    err("store not seen by second mapping");
+  if (read(fd, buf, 11) != 11 || buf[10] != 'B')
+    err("store not seen by read");
+
+  // a child's store is seen by the parent too.
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    p1[PGSIZE+1] = 'C';
+    exit(0);
+  }
+  wait(0);
+  if (p2[PGSIZE+1] != 'C')
+    err("child's store not seen");
+
+  if (munmap(p1, PGSIZE*2) == -1 || munmap(p2, PGSIZE*2) == -1)
+    err("munmap");
+  close(fd);
+  unlink(f);
+
+  printf("shared_test OK\n");
+}
+
+//
+// scan a file bigger than the fault-around window through
+// mappings with each kind of madvise() hint, and check that
+// every page comes back with the right content.
+//
+void
+scan_test(void)
+{
+  enum { NPG = 40 };
+  int fd, i, j, k;
+  int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+  const char * const f = "mmap.scan";
+
+  printf("scan_test starting\n");
+  testname = "scan_test";
+
+  unlink(f);
+  if ((fd = open(f, O_RDWR | O_CREATE)) == -1)
+    err("open");
+  for (i = 0; i < NPG*PGSIZE/BSIZE; i++) {
+    for (j = 0; j < BSIZE; j++)
+      buf[j] = (i * BSIZE + j) / PGSIZE + j;
+    if (write(fd, buf, BSIZE) != BSIZE)
+      err("write");
+  }
+
+  for (k = 0; k < sizeof(advice)/sizeof(advice[0]); k++) {
+    char *p = mmap(0, NPG*PGSIZE, PROT_READ, k % 2 ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+      err("mmap");
+    if (madvise(p, NPG*PGSIZE, advice[k]) != 0)
+      err("madvise");
+    for (i = 0; i < NPG*PGSIZE; i++) {
+      if (p[i] != (char)(i / PGSIZE + i % BSIZE)) {
+        printf("mismatch at %d with advice %d\n", i, advice[k]);
+        err("content");
+      }
+    }
+    if (munmap(p, NPG*PGSIZE) == -1)
+      err("munmap");
+  }
+
+  if (madvise((char *)PGSIZE, PGSIZE, MADV_NORMAL) != -1)
+    err("madvise outside a mapping should fail");
+
+  close(fd);
+  unlink(f);
+  printf("scan_test OK\n");
+}
+
+//
+// map many regions, then check that munmap can punch a hole in
+// the middle of one, and that a new mapping reuses a freed gap.
+//
+void
+regions_test(void)
+{
+  enum { N = 8 };
+  int fd, i;
+  char *p[N], *q;
+  const char * const f = "mmap.dur";
+
+  printf("regions_test starting\n");
+  testname = "regions_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  for (i = 0; i < N; i++) {
+    if ((p[i] = mmap(0, PGSIZE*2, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      err("mmap");
+    if (i > 0 && p[i] <= p[i-1])
+      err("regions not placed in order");
+  }
+  for (i = 0; i < N; i++)
+    _v1(p[i]);
+
+  // free the third region, and check its gap is reused.
+  if (munmap(p[2], PGSIZE*2) == -1)
+    err("munmap (1)");
+  if ((q = mmap(0, PGSIZE*2, PROT_READ, MAP_PRIVATE, fd, 0)) != p[2])
+    err("gap not reused");
+  _v1(q);
+
+  // split a three-page region by unmapping its middle page.
+  if ((q = mmap(0, PGSIZE*3, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    err("mmap (2)");
+  if (munmap(q + PGSIZE, PGSIZE) == -1)
+    err("munmap (2)");
+  if (q[0] != 'A' || q[PGSIZE*2] != 0)
+    err("split region content");
+  if (munmap(q, PGSIZE) == -1 || munmap(q + PGSIZE*2, PGSIZE) == -1)
+    err("munmap (3)");
+  if (munmap(q, PGSIZE) != -1)
+    err("munmap of a removed region should fail");
+
+  for (i = 0; i < N; i++)
+    if (munmap(p[i], PGSIZE*2) == -1)
+      err("munmap (4)");
+  close(fd);
+  unlink(f);
+  printf("regions_test OK\n");
+}
+
+//
+// touch a few pages far apart in a large shared mapping, and
+// check that munmap writes back the dirty run at its start.
+//
+void
+sparse_test(void)
+{
+  int fd, i;
+  int len = 256 * 1024 * 1024;
+  const char * const f = "mmap.dur";
+
+  printf("sparse_test starting\n");
+  testname = "sparse_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  char *p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+  for (i = 0; i < PGSIZE*2; i++)
+    p[i] = 'W';
+  if (p[len/2] != 0 || p[len - 1] != 0)
+    err("pages past the end of the file should be zero");
+  if (munmap(p, len) == -1)
+    err("munmap");
+
+  for (i = 0; i < PGSIZE*2; i++) {
+    char b;
+    if (read(fd, &b, 1) != 1 || b != 'W')
+      err("dirty pages not written back");
+  }
+  close(fd);
+  unlink(f);
+  printf("sparse_test OK\n");
+}
+
+//
+// anonymous memory: zero until written, copy-on-write across
+// fork when private, shared with the child when MAP_SHARED.
+//
+void
+anon_test(void)
+{
+  int i, pid, xstatus, fds[2];
+  int len = 64 * 1024 * 1024;
+
+  printf("anon_test starting\n");
+  testname = "anon_test";
+
+  char *p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    err("mmap (1)");
+  // far more than physical memory if each read took a page.
+  for (i = 0; i < len; i += PGSIZE)
+    if (p[i] != 0)
+      err("anonymous memory not zero");
+  p[0] = 'a';
+  if (p[0] != 'a' || p[PGSIZE] != 0)
+    err("store to zero page");
+
+  // the kernel faults untouched pages in for read().
+  if (pipe(fds) < 0)
+    err("pipe");
+  if (write(fds[1], "xyz", 3) != 3 || read(fds[0], p + len/2, 3) != 3)
+    err("pipe read into anonymous memory");
+  close(fds[0]);
+  close(fds[1]);
+  if (p[len/2] != 'x' || p[len/2 + 2] != 'z')
+    err("read() data");
+
+  char *s = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (s == MAP_FAILED)
+    err("mmap (2)");
+  s[0] = 's';
+
+  if ((pid = fork()) < 0)
+    err("fork");
+  if (pid == 0) {
+    if (p[0] != 'a' || p[len/2] != 'x' || p[PGSIZE] != 0 || s[0] != 's')
+      err("child's copy");
+    p[0] = 'c';
+    s[0] = 'c';
+    s[PGSIZE] = 'd';  // a page nobody touched before the fork
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0)
+    exit(1);
+  if (p[0] != 'a')
+    err("private page changed by child");
+  if (s[0] != 'c')
+    err("shared page not changed by child");
+  if (s[PGSIZE] != 'd')
+    err("shared page first touched after fork not shared");
+
+  if (munmap(p, len) == -1 || munmap(s, 2*PGSIZE) == -1)
+    err("munmap");
+  printf("anon_test OK\n");
+}
+
+//
+// msync writes a shared mapping back while it stays mapped,
+// and checks its arguments.
+//
+void
+msync_test(void)
+{
+  int fd, i;
+  const char * const f = "mmap.dur";
+
+  printf("msync_test starting\n");
+  testname = "msync_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  char *p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+  for (i = 0; i < PGSIZE; i++)
+    p[i] = 'M';
+  if (msync(p, PGSIZE*2, MS_SYNC) == -1)
+    err("msync");
+  if (msync(p, PGSIZE, MS_ASYNC) == -1)
+    err("msync MS_ASYNC");
+  if (msync(p, PGSIZE, MS_ASYNC | MS_SYNC) != -1)
+    err("msync with MS_ASYNC and MS_SYNC should fail");
+  if (msync(p + 1, PGSIZE, MS_SYNC) != -1)
+    err("msync of an unaligned address should fail");
+  if (msync(p + PGSIZE*2, PGSIZE, MS_SYNC) != -1)
+    err("msync of an unmapped range should fail");
+
+  // still mapped, and still writable after being cleaned.
+  p[1] = 'N';
+  if (msync(p, PGSIZE, MS_SYNC) == -1)
+    err("msync (2)");
+  char b[2];
+  if (read(fd, b, 2) != 2 || b[0] != 'M' || b[1] != 'N')
+    err("file contents");
+  if (munmap(p, PGSIZE*2) == -1)
+    err("munmap");
+  close(fd);
+  unlink(f);
+  printf("msync_test OK\n");
+}
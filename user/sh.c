@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,86 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// How many spawn actions cmd needs, or -1 if it can't be run
+// by spawn alone: it is made only of commands, redirections
+// and pipes.
+int
+spawnacts(struct cmd *cmd)
+{
+  int l, r;
+
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] ? 0 : -1;
+  case REDIR:
+    l = spawnacts(((struct redircmd*)cmd)->cmd);
+    return l < 0 ? -1 : l + 1;
+  case PIPE:
+    l = spawnacts(((struct pipecmd*)cmd)->left);
+    r = spawnacts(((struct pipecmd*)cmd)->right);
+    if(l < 0 || r < 0)
+      return -1;
+    return 3 + (l > r ? l : r);
+  }
+  return -1;
+}
+
+void
+setact(struct spawnact *act, int op, int fd, int arg, char *path)
+{
+  act->op = op;
+  act->fd = fd;
+  act->arg = arg;
+  act->path = path;
+}
+
+// Start the commands of cmd with spawn, each with the actions
+// act[0..nact) ahead of its own. Returns how many were started;
+// a pipe that cannot be made starts neither of its sides.
+int
+startcmd(struct cmd *cmd, struct spawnact *act, int nact)
+{
+  int p[2], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("startcmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(spawn(ecmd->argv[0], ecmd->argv, act, nact) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    setact(&act[nact], SPAWN_OPEN, rcmd->fd, rcmd->mode, rcmd->file);
+    return startcmd(rcmd->cmd, act, nact+1);
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      // not panic: this is the interactive shell, not a child.
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    setact(&act[nact+1], SPAWN_CLOSE, p[0], 0, 0);
+    setact(&act[nact+2], SPAWN_CLOSE, p[1], 0, 0);
+    setact(&act[nact], SPAWN_DUP2, 1, p[1], 0);
+    n = startcmd(pcmd->left, act, nact+3);
+    setact(&act[nact], SPAWN_DUP2, 0, p[0], 0);
+    n += startcmd(pcmd->right, act, nact+3);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +227,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static struct spawnact act[NSPAWNACT];
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +248,19 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    n = spawnacts(cmd);
+    if(n >= 0 && n <= NSPAWNACT){
+      // no need for a copy of the shell: spawn the commands.
+      for(n = startcmd(cmd, act, 0); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -319,6 +413,18 @@ peek(char **ps, char *es, char *toks)
   return *s && strchr(toks, *s);
 }
 
+int parseerr;  // set by syntax
+
+// Report a syntax error. The parser carries on as best it can
+// and parsecmd returns 0, rather than the shell exiting.
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    fprintf(2, "%s\n", msg);
+  parseerr = 1;
+}
+
 struct cmd *parseline(char**, char*);
 struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
@@ -330,12 +436,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +490,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +518,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +546,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +610,28 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -1,27 +1,80 @@
 #include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/trace.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
+// with -r, the calls are recorded in the kernel's trace rings
+// while command runs, and printed when it is done, with their
+// times. only the last few hundred per CPU are kept.
+
+void
+dump(int fd, int print)
+{
+  struct tracerec r[16];
+  int n, i;
+
+  while((n = read(fd, r, sizeof(r))) > 0){
+    for(i = 0; print && i < n / sizeof(r[0]); i++)
+      printf("%d: syscall %d(%p, %p, %p) -> %d in %d ns\n",
+             r[i].pid, r[i].num, r[i].arg[0], r[i].arg[1], r[i].arg[2],
+             (int)r[i].ret, (int)((r[i].end - r[i].start) * NSPERTIME));
+  }
+}
+
+// mask is decimal, like atoi's, but may have all 64 bits.
+uint64
+atomask(char *s)
+{
+  uint64 mask = 0;
+
+  while(*s >= '0' && *s <= '9')
+    mask = mask*10 + *s++ - '0';
+  return mask;
+}
+
 int
 main(int argc, char *argv[])
 {
-  int i;
+  int i, fd = -1, rec = 0;
   char *nargv[MAXARG];
 
+  if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    rec = 1;
+    argv++;
+    argc--;
+  }
   if(argc < 3 || (argv[1][0] < '0' || argv[1][0] > '9')){
-    fprintf(2, "Usage: %s mask command\n", argv[0]);
+    fprintf(2, "Usage: trace [-r] mask command\n");
     exit(1);
   }
 
-  if (trace(atoi(argv[1])) < 0) {
-    fprintf(2, "%s: trace failed\n", argv[0]);
+  if(rec){
+    if((fd = open("trace", O_RDWR)) < 0 || write(fd, "1", 1) != 1){
+      fprintf(2, "trace: cannot open trace device\n");
+      exit(1);
+    }
+    dump(fd, 0);  // whatever was left from before
+    if(fork() != 0){
+      wait(0);
+      dump(fd, 1);
+      write(fd, "0", 1);
+      exit(0);
+    }
+    close(fd);
+  }
+
+  if (trace(atomask(argv[1])) < 0) {
+    fprintf(2, "trace: trace failed\n");
     exit(1);
   }
-  
+
   for(i = 2; i < argc && i < MAXARG; i++){
     nargv[i-2] = argv[i];
   }
+  nargv[i-2] = 0;
   exec(nargv[0], nargv);
   exit(0);
 }
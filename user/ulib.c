@@ -1,10 +1,8 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
-#ifdef LAB_PGTBL
 #include "kernel/riscv.h"
 #include "kernel/memlayout.h"
-#endif
 #include "user/user.h"
 
 
@@ -38,14 +36,32 @@ strlen(const char *s)
   return n;
 }
 
+// memset, memcmp and memmove go a word at a time, eight words
+// per loop for long runs, once the pointers are 8-byte aligned,
+// as in the kernel's string.c.
+#define WORD 8  // bytes in a uint64
+#define ALIGNED(p) (((uint64)(p) & (WORD-1)) == 0)
+#define ALIKE(p, q) ((((uint64)(p) ^ (uint64)(q)) & (WORD-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 *w, pat;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  pat = (uchar)c * 0x0101010101010101UL;
+  w = (uint64*)cdst;
+  for(; n >= 8*WORD; n -= 8*WORD, w += 8){
+    w[0] = pat; w[1] = pat; w[2] = pat; w[3] = pat;
+    w[4] = pat; w[5] = pat; w[6] = pat; w[7] = pat;
   }
+  for(; n >= WORD; n -= WORD)
+    *w++ = pat;
+  cdst = (char*)w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -106,15 +122,40 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  uint64 *wd;
+  const uint64 *ws;
 
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if (ALIKE(src, dst)) {
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *dst++ = *src++;
+      wd = (uint64*)dst;
+      ws = (const uint64*)src;
+      for(; n >= 8*WORD; n -= 8*WORD, wd += 8, ws += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= WORD; n -= WORD)
+        *wd++ = *ws++;
+      dst = (char*)wd;
+      src = (const char*)ws;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if (ALIKE(src, dst)) {
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= WORD; n -= WORD){
+        dst -= WORD;
+        src -= WORD;
+        *(uint64*)dst = *(const uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -125,6 +166,15 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if (ALIKE(p1, p2)) {
+    for(; n > 0 && !ALIGNED(p1) && *p1 == *p2; n--)
+      p1++, p2++;
+    if (ALIGNED(p1)) {
+      // skip equal words; the bytes below find a difference.
+      for(; n >= WORD && *(uint64*)p1 == *(uint64*)p2; n -= WORD)
+        p1 += WORD, p2 += WORD;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -141,11 +191,45 @@ memcpy(void *dst, const void *src, uint n)
   return memmove(dst, src, n);
 }
 
-#ifdef LAB_PGTBL
 int
 ugetpid(void)
 {
   struct usyscall *u = (struct usyscall *)USYSCALL;
   return u->pid;
 }
-#endif
+
+// the clock ticks since boot, like uptime().
+uint
+uuptime(void)
+{
+  volatile struct vdso *v = (struct vdso *)VDSO;
+  return v->ticks;
+}
+
+// nanoseconds since boot, from the time CSR.
+uint64
+uclock(void)
+{
+  volatile struct vdso *v = (struct vdso *)VDSO;
+  uint64 t;
+
+  asm volatile("rdtime %0" : "=r" (t));
+  return t * v->nspertime;
+}
+
+int
+uncpu(void)
+{
+  volatile struct vdso *v = (struct vdso *)VDSO;
+  return v->ncpu;
+}
+
+// free memory in bytes, as of the last clock tick. unlike
+// sysinfo(), it leaves out page cache pages the kernel could
+// reclaim.
+uint64
+ufreemem(void)
+{
+  volatile struct vdso *v = (struct vdso *)VDSO;
+  return v->freemem;
+}
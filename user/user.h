@@ -1,6 +1,10 @@
 struct stat;
 struct rtcdate;
 struct sysinfo;
+struct direntplus;
+struct spawnact;
+struct ring;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -29,8 +33,6 @@ int connect(uint32, uint16, uint16);
 #endif
 #ifdef LAB_PGTBL
 int pgaccess(void *base, int len, void *mask);
-// usyscall region
-int ugetpid(void);
 #endif
 // traps lab
 int sigalarm(int, void (*)(void));
@@ -39,15 +41,30 @@ int sigreturn(void);
 int connect(uint32, uint16, uint16);
 // pgtbl lab
 int pgaccess(void *base, int len, void *mask);
-// usyscall region
+// usyscall and vdso pages, read without a system call
 int ugetpid(void);
+uint uuptime(void);
+uint64 uclock(void);
+int uncpu(void);
+uint64 ufreemem(void);
 // added syscall
-int trace(int);
+int trace(uint64);
 int sysinfo(struct sysinfo*);
 
 // lab
 char *mmap(void *, int, int, int, int, int);
 int munmap(void *, int);
+int madvise(void *, int, int);
+int msync(void *, int, int);
+int spawn(char*, char**, struct spawnact*, int);
+int ringenter(struct ring*);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int sendfile(int, int, int, int);
+int vmsplice(int, void*, int);
+int getdents(int, struct direntplus*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
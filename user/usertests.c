@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "kernel/ring.h"
+#include "kernel/uio.h"
+#include "kernel/trace.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -335,6 +339,184 @@ truncate1(char *s)
   close(fd3);
 }
 
+// grow a directory well past one block, so that it is hashed
+// and its leaves split, then check lookups, read(), and that
+// it can be emptied and removed.
+void
+hashdir(char *s)
+{
+  enum { N = 300 };
+  char name[40];
+  struct dirent de;
+  struct direntplus dx[10];
+  struct stat st;
+  int fd, i, n;
+
+  if(mkdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  fd = open("hd/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create hd/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    memmove(name, "hd/a-rather-long-entry-name-", 28);
+    name[28] = '0' + i / 100;
+    name[29] = '0' + (i / 10) % 10;
+    name[30] = '0' + i % 10;
+    name[31] = '\0';
+    if(link("hd/f", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(stat("hd", &st) != 0 || st.size <= BSIZE){
+    printf("%s: hd did not grow\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memmove(name, "hd/a-rather-long-entry-name-", 28);
+    name[28] = '0' + i / 100;
+    name[29] = '0' + (i / 10) % 10;
+    name[30] = '0' + i % 10;
+    name[31] = '\0';
+    if(stat(name, &st) != 0 || st.nlink != N + 1){
+      printf("%s: stat %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  // ".", "..", "f" and the N links.
+  fd = open("hd", O_RDONLY);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != N + 3){
+    printf("%s: read %d entries from hd, expected %d\n", s, n, N + 3);
+    exit(1);
+  }
+
+  // getdents should see the same entries, with their inodes' types.
+  fd = open("hd", O_RDONLY);
+  n = 0;
+  while((i = getdents(fd, dx, sizeof(dx)/sizeof(dx[0]))) > 0){
+    for(int j = 0; j < i; j++){
+      if(dx[j].type != (strcmp(dx[j].name, ".") == 0 || strcmp(dx[j].name, "..") == 0 ? T_DIR : T_FILE)){
+        printf("%s: getdents: %s has type %d\n", s, dx[j].name, dx[j].type);
+        exit(1);
+      }
+    }
+    n += i;
+  }
+  close(fd);
+  if(i < 0 || n != N + 3){
+    printf("%s: getdents saw %d entries in hd, expected %d\n", s, n, N + 3);
+    exit(1);
+  }
+
+  if(unlink("hd") == 0){
+    printf("%s: unlink non-empty hd succeeded!\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memmove(name, "hd/a-rather-long-entry-name-", 28);
+    name[28] = '0' + i / 100;
+    name[29] = '0' + (i / 10) % 10;
+    name[30] = '0' + i % 10;
+    name[31] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd/f") != 0 || unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
+// grow a file from inline (in the inode) to block-backed
+// and back via truncation, checking the content each step.
+void
+inlinefile(char *s)
+{
+  char buf[3*NINLINE], rbuf[3*NINLINE];
+  int fd, i, n;
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+
+  unlink("inlinef");
+  fd = open("inlinef", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  // fill up to exactly NINLINE, then spill over in one write.
+  if(write(fd, buf, NINLINE-10) != NINLINE-10 ||
+     write(fd, buf+NINLINE-10, 10) != 10 ||
+     write(fd, buf+NINLINE, 2*NINLINE) != 2*NINLINE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("inlinef", O_RDONLY);
+  n = read(fd, rbuf, sizeof(rbuf));
+  close(fd);
+  if(n != sizeof(buf) || memcmp(buf, rbuf, n) != 0){
+    printf("%s: read back %d bytes, wrong content\n", s, n);
+    exit(1);
+  }
+
+  fd = open("inlinef", O_RDWR|O_TRUNC);
+  if(write(fd, "xyz", 3) != 3){
+    printf("%s: write after truncate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inlinef", O_RDONLY);
+  n = read(fd, rbuf, sizeof(rbuf));
+  close(fd);
+  if(n != 3 || memcmp(rbuf, "xyz", 3) != 0){
+    printf("%s: read %d bytes after truncate\n", s, n);
+    exit(1);
+  }
+
+  // a directory also starts inline and spills as it grows.
+  mkdir("inlined");
+  for(i = 0; i < 20; i++){
+    char name[] = "inlined/f00";
+    name[9] = '0' + i / 10;
+    name[10] = '0' + i % 10;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < 20; i++){
+    char name[] = "inlined/f00";
+    name[9] = '0' + i / 10;
+    name[10] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("inlined") != 0 || unlink("inlinef") != 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
 // write to an open FD whose file has just been truncated.
 // this causes a write at an offset beyond the end of the file.
 // such writes fail on xv6 (unlike POSIX) but at least
@@ -724,6 +906,193 @@ exectest(char *s)
 
 }
 
+// spawn with fd actions, like exectest's fork, close,
+// open and exec.
+void
+spawntest(char *s)
+{
+  int fd, xstatus, pid, p[2], n, m;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[8];
+  struct spawnact act[3];
+
+  unlink("echo-ok");
+  act[0].op = SPAWN_OPEN;
+  act[0].fd = 1;
+  act[0].arg = O_CREATE|O_WRONLY;
+  act[0].path = "echo-ok";
+  if((pid = spawn("echo", echoargv, act, 1)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  fd = open("echo-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("echo-ok");
+
+  // into a pipe.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = 1;
+  act[0].arg = p[1];
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = p[0];
+  act[2].op = SPAWN_CLOSE;
+  act[2].fd = p[1];
+  if((pid = spawn("echo", echoargv, act, 3)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  n = 0;
+  while((m = read(p[0], buf + n, sizeof(buf) - n)) > 0)
+    n += m;
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output from pipe\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  wait(0);
+
+  // failures start nothing.
+  if(spawn("nosuchprogram", echoargv, 0, 0) != -1){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = 1;
+  act[0].arg = NOFILE - 1;
+  if(spawn("echo", echoargv, act, 1) != -1){
+    printf("%s: spawn with a bad action succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// the parent goes on in its own memory after spawn, and after
+// the child is gone, however the kernel loads page tables.
+void
+spawntestmem(char *s)
+{
+  enum { N = 3*4096 };
+  char *echoargv[] = { "echo", "spawn", 0 };
+  struct spawnact act;
+  char *a;
+  int i, j, pid, xstatus;
+
+  act.op = SPAWN_CLOSE;  // keep the console quiet
+  act.fd = 1;
+  a = sbrk(N);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i] = i % 251;
+  for(j = 0; j < 4; j++){
+    if((pid = spawn("echo", echoargv, &act, 1)) < 0){
+      printf("%s: spawn failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      if(a[i] != (char)(i % 251)){
+        printf("%s: memory changed after spawn\n", s);
+        exit(1);
+      }
+    }
+    if(wait(&xstatus) != pid || xstatus != 0){
+      printf("%s: wait failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      if(a[i] != (char)(i % 251)){
+        printf("%s: memory changed after the child exited\n", s);
+        exit(1);
+      }
+    }
+  }
+  sbrk(-N);
+}
+
+// a program's file cannot be written while it runs, since its
+// pages are mapped straight from the page cache.
+void
+txtbusy(char *s)
+{
+  char buf[512];
+  char *catargv[] = { "txtbusy", 0 };
+  struct spawnact act[2];
+  int fds[2], fd, wfd, n, pid, xstatus;
+
+  // a copy of cat, which runs until its input is closed.
+  if((fd = open("cat", O_RDONLY)) < 0 ||
+     (wfd = open("txtbusy", O_CREATE|O_WRONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(wfd, buf, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = 0;
+  act[0].arg = fds[0];
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fds[1];
+  if((pid = spawn("txtbusy", catargv, act, 2)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+
+  // wfd was opened before the program started.
+  if(write(wfd, "x", 1) >= 0){
+    printf("%s: wrote a running program\n", s);
+    exit(1);
+  }
+  if(open("txtbusy", O_WRONLY) >= 0 || open("txtbusy", O_RDONLY|O_TRUNC) >= 0){
+    printf("%s: opened a running program for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("txtbusy", O_RDONLY)) < 0){
+    printf("%s: cannot read a running program\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  close(fds[0]);
+  close(fds[1]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(write(wfd, "x", 1) != 1){
+    printf("%s: cannot write the program after it exited\n", s);
+    exit(1);
+  }
+  close(wfd);
+  unlink("txtbusy");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1870,45 +2239,45 @@ fourteen(char *s)
 {
   int fd;
 
-  // DIRSIZ is 14.
+  // DIRSIZ is 30.
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(mkdir("123456789012345678901234567890") != 0){
+    printf("%s: mkdir 123456789012345678901234567890 failed\n", s);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  if(mkdir("123456789012345678901234567890/1234567890123456789012345678901") != 0){
+    printf("%s: mkdir 123456789012345678901234567890/1234567890123456789012345678901 failed\n", s);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  fd = open("1234567890123456789012345678901/1234567890123456789012345678901/1234567890123456789012345678901", O_CREATE);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: create 1234567890123456789012345678901/1234567890123456789012345678901/1234567890123456789012345678901 failed\n", s);
     exit(1);
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  fd = open("123456789012345678901234567890/123456789012345678901234567890/123456789012345678901234567890", 0);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: open 123456789012345678901234567890/123456789012345678901234567890/123456789012345678901234567890 failed\n", s);
     exit(1);
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+  if(mkdir("123456789012345678901234567890/123456789012345678901234567890") == 0){
+    printf("%s: mkdir 123456789012345678901234567890/123456789012345678901234567890 succeeded!\n", s);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  if(mkdir("1234567890123456789012345678901/123456789012345678901234567890") == 0){
+    printf("%s: mkdir 123456789012345678901234567890/1234567890123456789012345678901 succeeded!\n", s);
     exit(1);
   }
 
   // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
+  unlink("1234567890123456789012345678901/123456789012345678901234567890");
+  unlink("123456789012345678901234567890/123456789012345678901234567890");
+  unlink("123456789012345678901234567890/123456789012345678901234567890/123456789012345678901234567890");
+  unlink("1234567890123456789012345678901/1234567890123456789012345678901/1234567890123456789012345678901");
+  unlink("123456789012345678901234567890/1234567890123456789012345678901");
+  unlink("123456789012345678901234567890");
 }
 
 void
@@ -2607,6 +2976,441 @@ sbrklast(char *s)
     exit(1);
 }
 
+// exec faults the program in as it is touched. pipes copy in
+// and out under a lock: do they see its text, and its bss?
+char lazybss[3*4096];
+
+void
+execlazy(char *s)
+{
+  int fds[2], i;
+  char *text = (char*)execlazy;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], text, 64) != 64){
+    printf("%s: write from text failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], lazybss + 4096, 64) != 64){
+    printf("%s: read into bss failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(memcmp(lazybss + 4096, text, 64) != 0){
+    printf("%s: text read back wrong\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(lazybss); i++){
+    if((i < 4096 || i >= 4096 + 64) && lazybss[i] != 0){
+      printf("%s: bss not zero\n", s);
+      exit(1);
+    }
+  }
+}
+
+// the usyscall and vdso pages agree with the system calls,
+// and the clock moves forward.
+void
+vdsotest(char *s)
+{
+  uint t0, t1;
+  uint64 c0, c1;
+
+  if(ugetpid() != getpid()){
+    printf("%s: ugetpid %d, getpid %d\n", s, ugetpid(), getpid());
+    exit(1);
+  }
+  if(uncpu() < 1){
+    printf("%s: %d cpus\n", s, uncpu());
+    exit(1);
+  }
+  if(ufreemem() == 0){
+    printf("%s: no free memory\n", s);
+    exit(1);
+  }
+  t0 = uuptime();
+  c0 = uclock();
+  sleep(2);
+  t1 = uuptime();
+  c1 = uclock();
+  if(t0 > uptime() || t1 < t0 + 2 || t1 > uptime()){
+    printf("%s: uuptime %d then %d, uptime %d\n", s, t0, t1, uptime());
+    exit(1);
+  }
+  if(c1 <= c0){
+    printf("%s: uclock went backwards\n", s);
+    exit(1);
+  }
+}
+
+static void
+ringsq(struct ring *r, int op, int fd, void *addr, int n)
+{
+  struct sqe *e = &r->sq[r->sqtail % RINGSIZE];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->data = r->sqtail++;
+}
+
+// one ringenter opens, writes and closes a file; another reads
+// it back. a full completion ring stops submission.
+void
+ringtest(char *s)
+{
+  static struct ring r;
+  char out[3][8];
+  int fd, i, res[3];
+  int want[] = { 3, 4, 0, -1 };
+  struct cqe *c;
+
+  unlink("ring");
+  ringsq(&r, RING_OPEN, 0, "ring", O_CREATE|O_WRONLY);
+  if(ringenter(&r) != 1 || (fd = r.cq[r.cqhead++ % RINGSIZE].res) < 0){
+    printf("%s: ring open failed\n", s);
+    exit(1);
+  }
+  ringsq(&r, RING_WRITE, fd, "abc", 3);
+  ringsq(&r, RING_WRITE, fd, "defg", 4);
+  ringsq(&r, RING_CLOSE, fd, 0, 0);
+  ringsq(&r, 99, fd, 0, 0);
+  if(ringenter(&r) != 4){
+    printf("%s: ringenter didn't take 4\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    c = &r.cq[r.cqhead++ % RINGSIZE];
+    if(c->data != r.sqtail - 4 + i || c->res != want[i]){
+      printf("%s: completion %d: data %d res %d\n", s, i, (int)c->data, c->res);
+      exit(1);
+    }
+  }
+
+  fd = open("ring", O_RDONLY);
+  for(i = 0; i < 3; i++)
+    ringsq(&r, RING_READ, fd, out[i], 5);
+  if(ringenter(&r) != 3){
+    printf("%s: ring reads failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++)
+    res[i] = r.cq[r.cqhead++ % RINGSIZE].res;
+  if(res[0] != 5 || res[1] != 2 || res[2] != 0 ||
+     memcmp(out[0], "abcde", 5) != 0 || memcmp(out[1], "fg", 2) != 0){
+    printf("%s: ring read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("ring");
+
+  // RINGSIZE completions fit; the next submission waits.
+  for(i = 0; i < RINGSIZE+1; i++)
+    ringsq(&r, RING_CLOSE, -1, 0, 0);
+  if(ringenter(&r) != RINGSIZE || r.sqhead != r.sqtail - 1){
+    printf("%s: ring overran its completions\n", s);
+    exit(1);
+  }
+  r.cqhead += RINGSIZE;
+  if(ringenter(&r) != 1 || r.cq[r.cqhead++ % RINGSIZE].res != -1){
+    printf("%s: ring didn't resume\n", s);
+    exit(1);
+  }
+}
+
+// writev and readv move several buffers; pread and pwrite
+// don't move the offset.
+void
+rwvtest(char *s)
+{
+  struct iovec iov[3];
+  char a[4], b[8];
+  int fd;
+
+  unlink("rwv");
+  fd = open("rwv", O_CREATE|O_RDWR);
+  iov[0].iov_base = "hello";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = ", world";
+  iov[2].iov_len = 7;
+  if(fd < 0 || writev(fd, iov, 3) != 12){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "W", 1, 7) != 1 || pread(fd, a, 4, 5) != 4 ||
+     memcmp(a, ", Wo", 4) != 0){
+    printf("%s: pwrite or pread failed\n", s);
+    exit(1);
+  }
+  // the offset is still at the end.
+  if(write(fd, "!", 1) != 1 || pread(fd, a, 4, 12) != 1 || a[0] != '!'){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("rwv", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fd, iov, 2) != 12 || memcmp(a, "hell", 4) != 0 ||
+     memcmp(b, "o, World", 8) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, 2) != 1 || a[0] != '!' || readv(fd, iov, 2) != 0){
+    printf("%s: readv at the end failed\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, IOV_MAX+1) != -1 || pread(fd, a, 1, -1) != -1){
+    printf("%s: bad readv or pread succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("rwv");
+}
+
+// sendfile from a file to a pipe, and from the pipe to another
+// file; and at an offset, leaving the file's own alone.
+void
+sendfiletest(char *s)
+{
+  enum { N = 3*4096 + 100 };
+  static char data[N], back[N];
+  int fd, fd2, fds[2], i, n, tot;
+
+  for(i = 0; i < N; i++)
+    data[i] = 'a' + i % 23;
+  unlink("sendf");
+  unlink("sendf2");
+  fd = open("sendf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("sendf", O_RDONLY);
+  fd2 = open("sendf2", O_CREATE|O_WRONLY);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  // 5000 bytes at offset 100 through the pipe; the pipe holds
+  // less than that, so a child drains it.
+  if(fork() == 0){
+    close(fds[1]);
+    for(tot = 0; (n = sendfile(fd2, fds[0], -1, N)) > 0; tot += n)
+      ;
+    exit(n == 0 && tot == 5000 ? 0 : 1);
+  }
+  close(fds[0]);
+  if(sendfile(fds[1], fd, 100, 5000) != 5000){
+    printf("%s: sendfile to pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  wait(&i);
+  if(i != 0){
+    printf("%s: sendfile from pipe failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+
+  // the offset was given, so fd's own is still 0.
+  if(read(fd, back, 10) != 10 || memcmp(back, data, 10) != 0){
+    printf("%s: sendfile moved the offset\n", s);
+    exit(1);
+  }
+  if(sendfile(fd, fd, -1, 1) != -1){
+    printf("%s: sendfile to a read-only file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd2 = open("sendf2", O_RDONLY);
+  if(read(fd2, back, N) != 5000 || memcmp(back, data + 100, 5000) != 0){
+    printf("%s: sendfile copied wrong\n", s);
+    exit(1);
+  }
+  close(fd2);
+  unlink("sendf");
+  unlink("sendf2");
+}
+
+// vmsplice gives the pipe whole anonymous pages, which then
+// read as zeros; a page-aligned read of a whole page takes the
+// pipe's. the data gets through either way.
+void
+pipegifttest(char *s)
+{
+  enum { N = 3*4096 };
+  char *a, *b;
+  int fds[2], i;
+
+  a = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  b = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(a == (char*)-1 || b == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i] = i % 251;
+  memset(b, 1, N);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(vmsplice(fds[1], a, N) != N){
+    printf("%s: vmsplice failed\n", s);
+    exit(1);
+  }
+  // a whole page, taken; then the rest, copied.
+  if(read(fds[0], b, 4096) != 4096 ||
+     read(fds[0], b + 4096, 100) != 100 ||
+     read(fds[0], b + 4096 + 100, N) != N - 4096 - 100){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(b[i] != (char)(i % 251)){
+      printf("%s: wrong byte %d\n", s, i);
+      exit(1);
+    }
+    if(a[i] != 0){
+      printf("%s: given page doesn't read as zeros\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  munmap(a, N);
+  munmap(b, N);
+}
+
+// with the trace device on, traced calls go to its rings, with
+// their arguments, results and times, not to the console.
+void
+tracetest(char *s)
+{
+  struct tracerec r[8];
+  char buf[1];
+  int fd, n, i, pid, found = 0;
+
+  if((fd = open("trace", O_RDWR)) < 0){
+    printf("%s: open trace failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "1", 1) != 1){
+    printf("%s: cannot turn tracing on\n", s);
+    exit(1);
+  }
+  while(read(fd, r, sizeof(r)) > 0)
+    ;
+  pid = getpid();
+  // pread is past bit 31 of the mask.
+  trace((1L << SYS_getpid) | (1L << SYS_pread));
+  for(i = 0; i < 3; i++){
+    getpid();
+    pread(-1, buf, 1, 0);
+  }
+  trace(0);
+  write(fd, "0", 1);
+  while((n = read(fd, r, sizeof(r))) > 0){
+    for(i = 0; i < n / sizeof(r[0]); i++){
+      if(r[i].pid != pid)
+        continue;
+      if((!(r[i].num == SYS_getpid && (int)r[i].ret == pid) &&
+          !(r[i].num == SYS_pread && (int)r[i].ret == -1)) ||
+         r[i].end < r[i].start){
+        printf("%s: bad record: call %d -> %d\n", s, r[i].num, (int)r[i].ret);
+        exit(1);
+      }
+      found++;
+    }
+  }
+  if(n < 0 || found != 6){
+    printf("%s: read %d, %d records of 6\n", s, n, found);
+    exit(1);
+  }
+  close(fd);
+}
+
+// sbrk grows the heap lazily. are untouched pages zero, both
+// to the program and to the kernel copying out of them, and
+// does a child see the touched ones?
+void
+sbrklazy(char *s)
+{
+  enum { BIG = 32*1024*1024 };
+  char *a, buf[16];
+  int fd, pid, xstatus, i;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(a[0] != 0 || a[BIG/2] != 0 || a[BIG-1] != 0){
+    printf("%s: new heap not zero\n", s);
+    exit(1);
+  }
+  a[BIG-1] = 'z';
+
+  // write() copies in from an untouched page.
+  unlink("lazy");
+  fd = open("lazy", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, a + BIG/4, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write from untouched heap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("lazy", O_RDONLY);
+  memset(buf, 'x', sizeof(buf));
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lazy");
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != 0){
+      printf("%s: untouched heap not zero to the kernel\n", s);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(a[BIG-1] != 'z' || a[BIG-2] != 0)
+      exit(1);
+    a[BIG-2] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[BIG-2] != 0){
+    printf("%s: child's heap wrong\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-BIG) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
 // does sbrk handle signed int32 wrap-around with
 // negative arguments?
 void
@@ -2830,6 +3634,8 @@ main(int argc, char *argv[])
     {truncate1, "truncate1"},
     {truncate2, "truncate2"},
     {truncate3, "truncate3"},
+    {inlinefile, "inlinefile"},
+    {hashdir, "hashdir"},
     {reparent2, "reparent2"},
     {pgbug, "pgbug" },
     {sbrkbugs, "sbrkbugs" },
@@ -2850,6 +3656,9 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {spawntestmem, "spawntestmem"},
+    {txtbusy, "txtbusy"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2859,6 +3668,14 @@ main(int argc, char *argv[])
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
     {sbrklast, "sbrklast"},
+    {sbrklazy, "sbrklazy"},
+    {execlazy, "execlazy"},
+    {vdsotest, "vdsotest"},
+    {ringtest, "ringtest"},
+    {rwvtest, "rwvtest"},
+    {sendfiletest, "sendfiletest"},
+    {pipegifttest, "pipegifttest"},
+    {tracetest, "tracetest"},
     {sbrk8000, "sbrk8000"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
@@ -45,3 +45,14 @@ entry("connect");
 entry("pgaccess");
 entry("mmap");
 entry("munmap");
+entry("getdents");
+entry("madvise");
+entry("msync");
+entry("spawn");
+entry("ringenter");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("sendfile");
+entry("vmsplice");
@@ -1,30 +1,57 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/ring.h"
 #include "user/user.h"
 
-char buf[512];
+#define NBUF 4  // reads per ringenter
+
+char buf[NBUF][512];
+struct ring ring;
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
+  int i, j, n, nbuf;
   int l, w, c, inword;
+  struct stat st;
+  struct sqe *e;
+
+  // a file can be read ahead, NBUF reads at once; a pipe or
+  // the console only as its data comes.
+  nbuf = fstat(fd, &st) == 0 && st.type == T_FILE ? NBUF : 1;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
+  do {
+    for(j = 0; j < nbuf; j++){
+      e = &ring.sq[ring.sqtail++ % RINGSIZE];
+      e->op = RING_READ;
+      e->fd = fd;
+      e->addr = (uint64)buf[j];
+      e->n = sizeof(buf[j]);
+    }
+    if(ringenter(&ring) != nbuf){
+      printf("wc: ringenter failed\n");
+      exit(1);
+    }
+    for(j = 0; j < nbuf; j++){
+      if((n = ring.cq[ring.cqhead++ % RINGSIZE].res) <= 0){
+        ring.cqhead += nbuf - 1 - j;
+        break;
+      }
+      for(i=0; i<n; i++){
+        c++;
+        if(buf[j][i] == '\n')
+          l++;
+        if(strchr(" \r\t\n\v", buf[j][i]))
+          inword = 0;
+        else if(!inword){
+          w++;
+          inword = 1;
+        }
       }
     }
-  }
+  } while(n > 0);
   if(n < 0){
     printf("wc: read error\n");
     exit(1);
@@ -27,16 +27,22 @@ main(int argc, char *argv[])
     char buf[512];
     
     // construct new arg list
-    char *nargv[argc];
+    char *nargv[argc + 1];
     memcpy(nargv, argv + 1, sizeof(char *) * (argc - 1));
     nargv[argc - 1] = buf;
+    nargv[argc] = 0;
 
     // TODO maybe separate the args by space?
+    // spawn copies the args, so buf can be reused at once.
+    int n = 0;
     while(readline(0, buf, sizeof(buf))) {
-        if(fork() == 0) {
-            exec(nargv[0], nargv);
+        if(spawn(nargv[0], nargv, 0, 0) < 0) {
+            fprintf(2, "xargs: exec %s failed\n", nargv[0]);
+        } else {
+            n++;
         }
     }
-    wait(0);
+    while(n-- > 0)
+        wait(0);
     exit(0);
 }
\ No newline at end of file